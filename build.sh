@@ -3,6 +3,7 @@
 
 
 # gcc -g -w fakeston.c evemu.c wayland-util.c evdev.c evdev-touchpad.c filter.c -o fakeston  -lm -ldl
-gcc --coverage -g fakeston.c fakeston_run.c evemu.c wayland-util.c compositor.h evdev.c evdev-touchpad.c filter.c -o fakeston_run  -lm -ldl
+gcc --coverage -g fakeston.c fakeston_run.c fakeston_compile.c fakeston_batch.c fakeston_map.c fakeston_sink.c fakeston_weston.c fakeston_loop.c fakeston_mtdev.c fakeston_desc.c fakeston_prof.c fakeston_accel.c evemu.c wayland-util.c compositor.h evdev.c evdev-touchpad.c filter.c -o fakeston_run  -Wl,--wrap=weston_filter_dispatch -Wl,--wrap=weston_filter_dispatch_batch -Wl,--wrap=create_pointer_accelator_filter -lm -ldl -lpthread
+gcc -O2 -g fakeston_bench.c fakeston.c fakeston_map.c fakeston_sink.c fakeston_weston.c fakeston_loop.c fakeston_mtdev.c fakeston_desc.c fakeston_prof.c fakeston_accel.c evemu.c wayland-util.c compositor.h evdev.c evdev-touchpad.c -o fakeston_bench  -Wl,--wrap=weston_filter_dispatch -Wl,--wrap=weston_filter_dispatch_batch -Wl,--wrap=create_pointer_accelator_filter -lm -ldl -lpthread
 
 
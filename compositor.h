@@ -856,6 +856,22 @@ void
 notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 	     wl_fixed_t x, wl_fixed_t y, int touch_type);
 
+enum weston_gesture {
+	WESTON_GESTURE_SWIPE,
+	WESTON_GESTURE_PINCH
+};
+
+enum weston_gesture_state {
+	WESTON_GESTURE_BEGIN,
+	WESTON_GESTURE_UPDATE,
+	WESTON_GESTURE_END
+};
+
+void
+notify_gesture(struct weston_seat *seat, uint32_t time,
+	       enum weston_gesture gesture, enum weston_gesture_state state,
+	       wl_fixed_t dx, wl_fixed_t dy, wl_fixed_t scale);
+
 void
 weston_layer_init(struct weston_layer *layer, struct wl_list *below);
 
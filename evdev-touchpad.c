@@ -38,6 +38,11 @@
 #define DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON BTN_LEFT
 #define DEFAULT_TOUCHPAD_SINGLE_TAP_TIMEOUT 100
 
+/* Three finger gestures: a swipe once the fingers moved this far (after
+ * acceleration), a pinch once their spread changed by this ratio */
+#define DEFAULT_GESTURE_SWIPE_DISTANCE 10.0
+#define DEFAULT_GESTURE_PINCH_RATIO 0.2
+
 enum touchpad_model {
 	TOUCHPAD_MODEL_UNKNOWN = 0,
 	TOUCHPAD_MODEL_SYNAPTICS,
@@ -102,6 +107,18 @@ enum fsm_state {
 	FSM_DRAG
 };
 
+/* FSM events pushed between two process_fsm_events(), a power of two */
+#define FSM_EVENT_QUEUE_LENGTH 16
+
+enum gesture_state {
+	GESTURE_NONE,
+	GESTURE_UNDECIDED,	/* three fingers down, not moved enough yet */
+	GESTURE_SWIPE,
+	GESTURE_PINCH
+};
+
+#define TOUCHPAD_MAX_SLOTS 5
+
 struct touchpad_dispatch {
 	struct evdev_dispatch base;
 	struct evdev_device *device;
@@ -123,7 +140,9 @@ struct touchpad_dispatch {
 	struct {
 		bool enable;
 
-		struct wl_array events;
+		enum fsm_event events[FSM_EVENT_QUEUE_LENGTH];
+		unsigned int events_head;
+		unsigned int events_count;
 		enum fsm_state state;
 		struct wl_event_source *timer_source;
 	} fsm;
@@ -133,6 +152,23 @@ struct touchpad_dispatch {
 		int32_t y;
 	} hw_abs;
 
+	/* the touches of a multitouch touchpad, for pinches */
+	struct {
+		int slot;
+		struct {
+			bool active;
+			int32_t x;
+			int32_t y;
+		} slots[TOUCHPAD_MAX_SLOTS];
+	} mt;
+
+	struct {
+		enum gesture_state state;
+		double dx;		/* motion while undecided */
+		double dy;
+		double spread;		/* of the touches when it began */
+	} gesture;
+
 	int has_pressure;
 	struct {
 		int32_t touch_low;
@@ -299,17 +335,16 @@ static void
 process_fsm_events(struct touchpad_dispatch *touchpad, uint32_t time)
 {
 	uint32_t timeout = UINT32_MAX;
-	enum fsm_event *pevent;
 	enum fsm_event event;
 
 	if (!touchpad->fsm.enable)
 		return;
 
-	if (touchpad->fsm.events.size == 0)
-		return;
-
-	wl_array_for_each(pevent, &touchpad->fsm.events) {
-		event = *pevent;
+	while (touchpad->fsm.events_count > 0) {
+		event = touchpad->fsm.events[touchpad->fsm.events_head];
+		touchpad->fsm.events_head = (touchpad->fsm.events_head + 1) %
+			FSM_EVENT_QUEUE_LENGTH;
+		touchpad->fsm.events_count--;
 		timeout = 0;
 
 		switch (touchpad->fsm.state) {
@@ -385,25 +420,26 @@ process_fsm_events(struct touchpad_dispatch *touchpad, uint32_t time)
 	if (timeout != UINT32_MAX)
 		wl_event_source_timer_update(touchpad->fsm.timer_source,
 					     timeout);
-
-	wl_array_release(&touchpad->fsm.events);
-	wl_array_init(&touchpad->fsm.events);
 }
 
 static void
 push_fsm_event(struct touchpad_dispatch *touchpad,
 	       enum fsm_event event)
 {
-	enum fsm_event *pevent;
+	unsigned int tail;
 
 	if (!touchpad->fsm.enable)
 		return;
 
-	pevent = wl_array_add(&touchpad->fsm.events, sizeof event);
-	if (pevent)
-		*pevent = event;
-	else
+	if (touchpad->fsm.events_count == FSM_EVENT_QUEUE_LENGTH) {
 		touchpad->fsm.state = FSM_IDLE;
+		return;
+	}
+
+	tail = (touchpad->fsm.events_head + touchpad->fsm.events_count) %
+		FSM_EVENT_QUEUE_LENGTH;
+	touchpad->fsm.events[tail] = event;
+	touchpad->fsm.events_count++;
 }
 
 static int
@@ -411,7 +447,7 @@ fsm_timout_handler(void *data)
 {
 	struct touchpad_dispatch *touchpad = data;
 
-	if (touchpad->fsm.events.size == 0) {
+	if (touchpad->fsm.events_count == 0) {
 		push_fsm_event(touchpad, FSM_EVENT_TIMEOUT);
 		process_fsm_events(touchpad, weston_compositor_get_time());
 	}
@@ -419,6 +455,121 @@ fsm_timout_handler(void *data)
 	return 1;
 }
 
+/* mean distance of the touches from their center, 0 for less than two */
+static double
+touches_spread(struct touchpad_dispatch *touchpad)
+{
+	double cx = 0.0, cy = 0.0, spread = 0.0;
+	int i, n = 0;
+
+	for (i = 0; i < TOUCHPAD_MAX_SLOTS; i++) {
+		if (!touchpad->mt.slots[i].active)
+			continue;
+		cx += touchpad->mt.slots[i].x;
+		cy += touchpad->mt.slots[i].y;
+		n++;
+	}
+	if (n < 2)
+		return 0.0;
+
+	cx /= n;
+	cy /= n;
+	for (i = 0; i < TOUCHPAD_MAX_SLOTS; i++)
+		if (touchpad->mt.slots[i].active)
+			spread += hypot(touchpad->mt.slots[i].x - cx,
+					touchpad->mt.slots[i].y - cy);
+
+	return spread / n;
+}
+
+static void
+notify_gesture_motion(struct touchpad_dispatch *touchpad, uint32_t time,
+		      enum weston_gesture gesture,
+		      enum weston_gesture_state state,
+		      double dx, double dy, double scale)
+{
+	notify_gesture(touchpad->device->seat, time, gesture, state,
+		       wl_fixed_from_double(dx), wl_fixed_from_double(dy),
+		       wl_fixed_from_double(scale));
+}
+
+static void
+gesture_end(struct touchpad_dispatch *touchpad, uint32_t time)
+{
+	switch (touchpad->gesture.state) {
+	case GESTURE_SWIPE:
+		notify_gesture_motion(touchpad, time, WESTON_GESTURE_SWIPE,
+				      WESTON_GESTURE_END, 0.0, 0.0, 1.0);
+		break;
+	case GESTURE_PINCH:
+		notify_gesture_motion(touchpad, time, WESTON_GESTURE_PINCH,
+				      WESTON_GESTURE_END, 0.0, 0.0, 1.0);
+		break;
+	default:
+		break;
+	}
+
+	touchpad->gesture.state = GESTURE_NONE;
+}
+
+static void
+gesture_begin(struct touchpad_dispatch *touchpad)
+{
+	touchpad->gesture.state = GESTURE_UNDECIDED;
+	touchpad->gesture.dx = 0.0;
+	touchpad->gesture.dy = 0.0;
+	touchpad->gesture.spread = 0.0;
+}
+
+/* Three fingers moved by dx, dy. A swipe or a pinch is decided once the
+ * fingers moved or spread far enough, then it follows the fingers. */
+static void
+gesture_motion(struct touchpad_dispatch *touchpad, uint32_t time,
+	       double dx, double dy)
+{
+	double spread = touches_spread(touchpad);
+	double scale = 1.0;
+
+	if (touchpad->gesture.spread <= 0.0)
+		touchpad->gesture.spread = spread;
+	if ((touchpad->gesture.spread > 0.0) && (spread > 0.0))
+		scale = spread / touchpad->gesture.spread;
+
+	switch (touchpad->gesture.state) {
+	case GESTURE_UNDECIDED:
+		touchpad->gesture.dx += dx;
+		touchpad->gesture.dy += dy;
+
+		if (fabs(scale - 1.0) > DEFAULT_GESTURE_PINCH_RATIO) {
+			touchpad->gesture.state = GESTURE_PINCH;
+			notify_gesture_motion(touchpad, time,
+					      WESTON_GESTURE_PINCH,
+					      WESTON_GESTURE_BEGIN,
+					      touchpad->gesture.dx,
+					      touchpad->gesture.dy, scale);
+		} else if (hypot(touchpad->gesture.dx, touchpad->gesture.dy) >
+			   DEFAULT_GESTURE_SWIPE_DISTANCE) {
+			touchpad->gesture.state = GESTURE_SWIPE;
+			notify_gesture_motion(touchpad, time,
+					      WESTON_GESTURE_SWIPE,
+					      WESTON_GESTURE_BEGIN,
+					      touchpad->gesture.dx,
+					      touchpad->gesture.dy, 1.0);
+		}
+		break;
+	case GESTURE_SWIPE:
+		notify_gesture_motion(touchpad, time, WESTON_GESTURE_SWIPE,
+				      WESTON_GESTURE_UPDATE, dx, dy, 1.0);
+		break;
+	case GESTURE_PINCH:
+		notify_gesture_motion(touchpad, time, WESTON_GESTURE_PINCH,
+				      WESTON_GESTURE_UPDATE, dx, dy, scale);
+		break;
+	default:
+		break;
+	}
+}
+
 static void
 touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
 {
@@ -436,6 +587,10 @@ touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
 
 		touchpad->last_finger_state = touchpad->finger_state;
 
+		gesture_end(touchpad, time);
+		if (touchpad->finger_state == TOUCHPAD_FINGERS_THREE)
+			gesture_begin(touchpad);
+
 		process_fsm_events(touchpad, time);
 
 		return;
@@ -501,6 +656,8 @@ touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
 					    time,
 					    WL_POINTER_AXIS_VERTICAL_SCROLL,
 					    wl_fixed_from_double(dy));
+		} else if (touchpad->finger_state == TOUCHPAD_FINGERS_THREE) {
+			gesture_motion(touchpad, time, dx, dy);
 		}
 	}
 
@@ -560,6 +717,22 @@ process_absolute(struct touchpad_dispatch *touchpad,
 			touchpad->event_mask |= TOUCHPAD_EVENT_ABSOLUTE_Y;
 		}
 		break;
+	case ABS_MT_SLOT:
+		touchpad->mt.slot = e->value;
+		break;
+	case ABS_MT_TRACKING_ID:
+		if ((unsigned int) touchpad->mt.slot < TOUCHPAD_MAX_SLOTS)
+			touchpad->mt.slots[touchpad->mt.slot].active =
+				e->value >= 0;
+		break;
+	case ABS_MT_POSITION_X:
+		if ((unsigned int) touchpad->mt.slot < TOUCHPAD_MAX_SLOTS)
+			touchpad->mt.slots[touchpad->mt.slot].x = e->value;
+		break;
+	case ABS_MT_POSITION_Y:
+		if ((unsigned int) touchpad->mt.slot < TOUCHPAD_MAX_SLOTS)
+			touchpad->mt.slots[touchpad->mt.slot].y = e->value;
+		break;
 	}
 }
 
@@ -732,9 +905,13 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 	touchpad->last_finger_state = 0;
 	touchpad->finger_state = 0;
 
-	wl_array_init(&touchpad->fsm.events);
+	touchpad->fsm.events_head = 0;
+	touchpad->fsm.events_count = 0;
 	touchpad->fsm.state = FSM_IDLE;
 
+	memset(&touchpad->mt, 0, sizeof touchpad->mt);
+	touchpad->gesture.state = GESTURE_NONE;
+
 	loop = wl_display_get_event_loop(device->seat->compositor->wl_display);
 	touchpad->fsm.timer_source =
 		wl_event_loop_add_timer(loop, fsm_timout_handler, touchpad);
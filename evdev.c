@@ -94,31 +94,34 @@ evdev_process_key(struct evdev_device *device, struct input_event *e, int time)
 static void
 evdev_process_touch(struct evdev_device *device, struct input_event *e)
 {
-	const int screen_width = device->output->current->width;
-	const int screen_height = device->output->current->height;
+	const int slot = device->mt.slot;
+	const unsigned long bit = BIT(slot);
 
-	switch (e->code) {
-	case ABS_MT_SLOT:
+	if (e->code == ABS_MT_SLOT) {
 		device->mt.slot = e->value;
-		break;
+		return;
+	}
+	if ((unsigned int) slot >= (unsigned int) device->mt.slots)
+		return;
+
+	switch (e->code) {
 	case ABS_MT_TRACKING_ID:
-		if (e->value >= 0)
+		if (e->value >= 0) {
+			device->mt.down[LONG(slot)] |= bit;
 			device->pending_events |= EVDEV_ABSOLUTE_MT_DOWN;
-		else
+		} else {
+			device->mt.up[LONG(slot)] |= bit;
 			device->pending_events |= EVDEV_ABSOLUTE_MT_UP;
+		}
 		break;
 	case ABS_MT_POSITION_X:
-		device->mt.x[device->mt.slot] =
-			(e->value - device->abs.min_x) * screen_width /
-			(device->abs.max_x - device->abs.min_x) +
-			device->output->x;
+		device->mt.x[slot] = e->value;
+		device->mt.motion[LONG(slot)] |= bit;
 		device->pending_events |= EVDEV_ABSOLUTE_MT_MOTION;
 		break;
 	case ABS_MT_POSITION_Y:
-		device->mt.y[device->mt.slot] =
-			(e->value - device->abs.min_y) * screen_height /
-			(device->abs.max_y - device->abs.min_y) +
-			device->output->y;
+		device->mt.y[slot] = e->value;
+		device->mt.motion[LONG(slot)] |= bit;
 		device->pending_events |= EVDEV_ABSOLUTE_MT_MOTION;
 		break;
 	}
@@ -128,22 +131,13 @@ static inline void
 evdev_process_absolute_motion(struct evdev_device *device,
 			      struct input_event *e)
 {
-	const int screen_width = device->output->current->width;
-	const int screen_height = device->output->current->height;
-
 	switch (e->code) {
 	case ABS_X:
-		device->abs.x =
-			(e->value - device->abs.min_x) * screen_width /
-			(device->abs.max_x - device->abs.min_x) +
-			device->output->x;
+		device->abs.x = e->value;
 		device->pending_events |= EVDEV_ABSOLUTE_MOTION;
 		break;
 	case ABS_Y:
-		device->abs.y =
-			(e->value - device->abs.min_y) * screen_height /
-			(device->abs.max_y - device->abs.min_y) +
-			device->output->y;
+		device->abs.y = e->value;
 		device->pending_events |= EVDEV_ABSOLUTE_MOTION;
 		break;
 	}
@@ -205,49 +199,133 @@ evdev_process_absolute(struct evdev_device *device, struct input_event *e)
 	}
 }
 
-static int
-is_motion_event(struct input_event *e)
+#define EVDEV_FIXED_ONE 4294967296.0	/* 1 in 32.32 fixed point */
+
+/* Recomputes the transform for the output as it is now. Without
+ * calibration the scale is rounded up, so that the pixels are those of
+ * value * width / range for values up to 2^32 / range off the minimum. */
+static void
+update_transform(struct evdev_device *device)
 {
-	switch (e->type) {
-	case EV_REL:
-		switch (e->code) {
-		case REL_X:
-		case REL_Y:
-			return 1;
-		}
-		break;
-	case EV_ABS:
-		switch (e->code) {
-		case ABS_X:
-		case ABS_Y:
-		case ABS_MT_POSITION_X:
-		case ABS_MT_POSITION_Y:
-			return 1;
-		}
+	struct weston_output *output = device->output;
+	int64_t *t = device->abs.transform;
+	const float *c = device->abs.calibration;
+	int64_t width = output->current->width;
+	int64_t height = output->current->height;
+	int64_t range_x = device->abs.max_x - device->abs.min_x;
+	int64_t range_y = device->abs.max_y - device->abs.min_y;
+	double sx, sy;
+
+	if (range_x <= 0)
+		range_x = 1;
+	if (range_y <= 0)
+		range_y = 1;
+
+	if (!device->abs.apply_calibration) {
+		t[0] = ((width << 32) + range_x - 1) / range_x;
+		t[1] = 0;
+		t[2] = (int64_t) output->x << 32;
+		t[3] = 0;
+		t[4] = ((height << 32) + range_y - 1) / range_y;
+		t[5] = (int64_t) output->y << 32;
+	} else {
+		sx = (double) width / range_x;
+		sy = (double) height / range_y;
+		t[0] = c[0] * sx * EVDEV_FIXED_ONE;
+		t[1] = c[1] * sy * EVDEV_FIXED_ONE;
+		t[2] = (c[0] * output->x + c[1] * output->y + c[2]) *
+			EVDEV_FIXED_ONE;
+		t[3] = c[3] * sx * EVDEV_FIXED_ONE;
+		t[4] = c[4] * sy * EVDEV_FIXED_ONE;
+		t[5] = (c[3] * output->x + c[4] * output->y + c[5]) *
+			EVDEV_FIXED_ONE;
 	}
 
-	return 0;
+	device->abs.made_for[0] = output->x;
+	device->abs.made_for[1] = output->y;
+	device->abs.made_for[2] = width;
+	device->abs.made_for[3] = height;
+	device->abs.transform_valid = 1;
 }
 
-static void
-transform_absolute(struct evdev_device *device)
+/* the output moved, changed its mode or the calibration changed */
+static inline int
+transform_stale(struct evdev_device *device)
 {
-	if (!device->abs.apply_calibration)
-		return;
+	const struct weston_output *output = device->output;
+	const int32_t *made_for = device->abs.made_for;
 
-	device->abs.x = device->abs.x * device->abs.calibration[0] +
-			device->abs.y * device->abs.calibration[1] +
-			device->abs.calibration[2];
+	return !device->abs.transform_valid ||
+		(made_for[0] != output->x) || (made_for[1] != output->y) ||
+		(made_for[2] != output->current->width) ||
+		(made_for[3] != output->current->height);
+}
+
+static inline void
+transform_absolute(struct evdev_device *device, int32_t x, int32_t y,
+		   int32_t *out_x, int32_t *out_y)
+{
+	const int64_t *t = device->abs.transform;
+	int64_t u = x - device->abs.min_x;
+	int64_t v = y - device->abs.min_y;
 
-	device->abs.y = device->abs.x * device->abs.calibration[3] +
-			device->abs.y * device->abs.calibration[4] +
-			device->abs.calibration[5];
+	*out_x = (t[0] * u + t[1] * v + t[2]) >> 32;
+	*out_y = (t[3] * u + t[4] * v + t[5]) >> 32;
 }
 
+/* every changed slot, in slot order: down or motion, then up */
 static void
+evdev_flush_touch(struct evdev_device *device, uint32_t time)
+{
+	struct weston_seat *master = device->seat;
+	unsigned long down, motion, up, changed, bit;
+	int32_t x, y;
+	int i, slot;
+
+	if (transform_stale(device))
+		update_transform(device);
+
+	for (i = 0; i < (int) NBITS(device->mt.slots); i++) {
+		down = device->mt.down[i];
+		motion = device->mt.motion[i];
+		up = device->mt.up[i];
+		changed = down | motion | up;
+		if (changed == 0)
+			continue;
+		device->mt.down[i] = 0;
+		device->mt.motion[i] = 0;
+		device->mt.up[i] = 0;
+
+		while (changed) {
+			bit = changed & -changed;
+			changed &= ~bit;
+			slot = i * BITS_PER_LONG + __builtin_ctzl(bit);
+
+			if ((down | motion) & bit) {
+				transform_absolute(device, device->mt.x[slot],
+						   device->mt.y[slot], &x, &y);
+				notify_touch(master, time, slot,
+					     wl_fixed_from_int(x),
+					     wl_fixed_from_int(y),
+					     (down & bit) ? WL_TOUCH_DOWN :
+							    WL_TOUCH_MOTION);
+			}
+			if (up & bit)
+				notify_touch(master, time, slot, 0, 0,
+					     WL_TOUCH_UP);
+		}
+	}
+
+	device->pending_events &= ~(EVDEV_ABSOLUTE_MT_DOWN |
+				    EVDEV_ABSOLUTE_MT_MOTION |
+				    EVDEV_ABSOLUTE_MT_UP);
+}
+
+void
 evdev_flush_motion(struct evdev_device *device, uint32_t time)
 {
 	struct weston_seat *master = device->seat;
+	int32_t x, y;
 
 	if (!(device->pending_events & EVDEV_SYN))
 		return;
@@ -259,34 +337,18 @@ evdev_flush_motion(struct evdev_device *device, uint32_t time)
 		device->rel.dx = 0;
 		device->rel.dy = 0;
 	}
-	if (device->pending_events & EVDEV_ABSOLUTE_MT_DOWN) {
-		notify_touch(master, time,
-			     device->mt.slot,
-			     wl_fixed_from_int(device->mt.x[device->mt.slot]),
-			     wl_fixed_from_int(device->mt.y[device->mt.slot]),
-			     WL_TOUCH_DOWN);
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_DOWN;
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_MOTION;
-	}
-	if (device->pending_events & EVDEV_ABSOLUTE_MT_MOTION) {
-		notify_touch(master, time,
-			     device->mt.slot,
-			     wl_fixed_from_int(device->mt.x[device->mt.slot]),
-			     wl_fixed_from_int(device->mt.y[device->mt.slot]),
-			     WL_TOUCH_MOTION);
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_DOWN;
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_MOTION;
-	}
-	if (device->pending_events & EVDEV_ABSOLUTE_MT_UP) {
-		notify_touch(master, time, device->mt.slot, 0, 0,
-			     WL_TOUCH_UP);
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_UP;
-	}
+	if (device->pending_events & (EVDEV_ABSOLUTE_MT_DOWN |
+				      EVDEV_ABSOLUTE_MT_MOTION |
+				      EVDEV_ABSOLUTE_MT_UP))
+		evdev_flush_touch(device, time);
 	if (device->pending_events & EVDEV_ABSOLUTE_MOTION) {
-		transform_absolute(device);
+		if (transform_stale(device))
+			update_transform(device);
+		transform_absolute(device, device->abs.x, device->abs.y,
+				   &x, &y);
 		notify_motion_absolute(master, time,
-			      wl_fixed_from_int(device->abs.x),
-			      wl_fixed_from_int(device->abs.y));
+			      wl_fixed_from_int(x),
+			      wl_fixed_from_int(y));
 		device->pending_events &= ~EVDEV_ABSOLUTE_MOTION;
 	}
 }
@@ -336,31 +398,162 @@ fallback_dispatch_create(void)
 	return dispatch;
 }
 
+/* Events classified at a time, one bit of a mask each */
+#define EVDEV_BATCH 32
+
+/* A burst of events classified in one pass over all of them, so the
+ * dispatch loop below needs no per-event decoding. */
+struct evdev_batch {
+	uint32_t motion;		/* bit i set if event i is motion */
+	uint32_t time[EVDEV_BATCH];	/* timestamps in ms */
+};
+
+/* Branch free over the whole batch, the compiler vectorizes the loops. */
 static void
+evdev_classify(struct evdev_batch *batch, const struct input_event *ev,
+	       int count)
+{
+	uint32_t motion = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+		batch->time[i] = ev[i].time.tv_sec * 1000 +
+				 ev[i].time.tv_usec / 1000;
+
+	for (i = 0; i < count; i++) {
+		uint32_t type = ev[i].type, code = ev[i].code;
+		uint32_t rel = (type == EV_REL) & (code <= REL_Y);
+		uint32_t abs = (type == EV_ABS) &
+			       ((code <= ABS_Y) |
+				(code - ABS_MT_POSITION_X <= 1u));
+
+		motion |= (rel | abs) << i;
+	}
+
+	batch->motion = motion;
+}
+
+/* Motion state is kept across calls, so a burst read in several chunks
+ * is processed exactly as if it had been read at once. The caller flushes
+ * the remaining motion when the fd is drained. */
+static uint32_t
 evdev_process_events(struct evdev_device *device,
-		     struct input_event *ev, int count)
+		     struct input_event *ev, int count, uint32_t time)
 {
 	struct evdev_dispatch *dispatch = device->dispatch;
-	struct input_event *e, *end;
-	uint32_t time = 0;
+	struct evdev_batch batch;
+	int i, n;
 
-	device->pending_events = 0;
+	for (; count > 0; ev += n, count -= n) {
+		n = count < EVDEV_BATCH ? count : EVDEV_BATCH;
+		evdev_classify(&batch, ev, n);
 
-	e = ev;
-	end = e + count;
-	for (e = ev; e < end; e++) {
-		time = e->time.tv_sec * 1000 + e->time.tv_usec / 1000;
+		for (i = 0; i < n; i++) {
+			time = batch.time[i];
 
-		/* we try to minimize the amount of notifications to be
-		 * forwarded to the compositor, so we accumulate motion
-		 * events and send as a bunch */
-		if (!is_motion_event(e))
-			evdev_flush_motion(device, time);
+			/* we try to minimize the amount of notifications to be
+			 * forwarded to the compositor, so we accumulate motion
+			 * events and send as a bunch */
+			if (!(batch.motion & (1u << i)))
+				evdev_flush_motion(device, time);
 
-		dispatch->interface->process(dispatch, device, e, time);
+			dispatch->interface->process(dispatch, device, &ev[i],
+						     time);
+		}
 	}
 
-	evdev_flush_motion(device, time);
+	return time;
+}
+
+/*
+ * Fallback devices skip the dispatch pointer: the loop below is inlined
+ * once per capability set with the event types it handles directly, any
+ * other event still goes through fallback_process().
+ */
+#define EVDEV_TYPE(type) (1u << (type))
+
+static inline __attribute__((always_inline)) uint32_t
+evdev_fallback_events(struct evdev_device *device,
+		      struct input_event *ev, int count, uint32_t time,
+		      const uint32_t types)
+{
+	struct evdev_batch batch;
+	struct input_event *e;
+	int i, n;
+
+	for (; count > 0; ev += n, count -= n) {
+		n = count < EVDEV_BATCH ? count : EVDEV_BATCH;
+		evdev_classify(&batch, ev, n);
+
+		for (i = 0; i < n; i++) {
+			e = &ev[i];
+			time = batch.time[i];
+
+			if (!(batch.motion & (1u << i)))
+				evdev_flush_motion(device, time);
+
+			if ((types & EVDEV_TYPE(EV_REL)) && (e->type == EV_REL))
+				evdev_process_relative(device, e, time);
+			else if ((types & EVDEV_TYPE(EV_KEY)) &&
+				 (e->type == EV_KEY))
+				evdev_process_key(device, e, time);
+			else if ((types & EVDEV_TYPE(EV_ABS)) &&
+				 (e->type == EV_ABS))
+				evdev_process_touch(device, e);
+			else if (e->type == EV_SYN)
+				device->pending_events |= EVDEV_SYN;
+			else
+				fallback_process(device->dispatch, device, e,
+						 time);
+		}
+	}
+
+	return time;
+}
+
+/* relative pointers, with or without buttons and keys */
+static uint32_t
+evdev_process_mouse(struct evdev_device *device,
+		    struct input_event *ev, int count, uint32_t time)
+{
+	return evdev_fallback_events(device, ev, count, time,
+				     EVDEV_TYPE(EV_REL) | EVDEV_TYPE(EV_KEY));
+}
+
+/* keys and buttons only */
+static uint32_t
+evdev_process_keyboard(struct evdev_device *device,
+		       struct input_event *ev, int count, uint32_t time)
+{
+	return evdev_fallback_events(device, ev, count, time,
+				     EVDEV_TYPE(EV_KEY));
+}
+
+/* multitouch, every EV_ABS goes to evdev_process_touch() */
+static uint32_t
+evdev_process_touchscreen(struct evdev_device *device,
+			  struct input_event *ev, int count, uint32_t time)
+{
+	return evdev_fallback_events(device, ev, count, time,
+				     EVDEV_TYPE(EV_ABS) | EVDEV_TYPE(EV_KEY));
+}
+
+static void
+evdev_pick_process(struct evdev_device *device)
+{
+	device->process_events = evdev_process_events;
+
+	if (device->dispatch->interface != &fallback_interface)
+		return;
+
+	if (device->is_mt)
+		device->process_events = evdev_process_touchscreen;
+	else if (device->caps & EVDEV_MOTION_ABS)
+		return;
+	else if (device->caps & EVDEV_MOTION_REL)
+		device->process_events = evdev_process_mouse;
+	else
+		device->process_events = evdev_process_keyboard;
 }
 
 static int
@@ -368,13 +561,20 @@ evdev_device_data(int fd, uint32_t mask, void *data)
 {
 	struct weston_compositor *ec;
 	struct evdev_device *device = data;
-	struct input_event ev[32];
+	struct input_event ev[EVDEV_BATCH];
+	uint32_t time = 0;
 	int len;
 
 	ec = device->seat->compositor;
 	if (!ec->focus)
 		return 1;
 
+	/* nothing of a frame cut short is flushed with the next one */
+	device->pending_events = 0;
+	if (device->mt.slots)
+		memset(device->mt.down, 0,
+		       3 * NBITS(device->mt.slots) * sizeof(unsigned long));
+
 	/* If the compositor is repainting, this function is called only once
 	 * per frame and we have to process all the events available on the
 	 * fd, otherwise there will be input lag. */
@@ -388,16 +588,55 @@ evdev_device_data(int fd, uint32_t mask, void *data)
 
 		if (len < 0 || len % sizeof ev[0] != 0) {
 			/* FIXME: call evdev_device_destroy when errno is ENODEV. */
-			return 1;
+			break;
 		}
 
-		evdev_process_events(device, ev, len / sizeof ev[0]);
+		time = device->process_events(device, ev, len / sizeof ev[0],
+					      time);
 
 	} while (len > 0);
 
+	evdev_flush_motion(device, time);
+
 	return 1;
 }
 
+/* sizes the slot state from the ABS_MT_SLOT maximum */
+static int
+evdev_mt_init(struct evdev_device *device, unsigned long *abs_bits)
+{
+	struct input_absinfo absinfo;
+	size_t words;
+	int slots = MAX_SLOTS;
+
+	if (TEST_BIT(abs_bits, ABS_MT_SLOT) &&
+	    (ioctl(device->fd, EVIOCGABS(ABS_MT_SLOT), &absinfo) >= 0) &&
+	    (absinfo.maximum >= 0)) {
+		slots = absinfo.maximum + 1;
+		if (absinfo.maximum >= EVDEV_MT_SLOTS_MAX) {
+			weston_log("input device %s, %s has %d touch slots, "
+				   "only the first %d are used\n",
+				   device->devname, device->devnode,
+				   absinfo.maximum + 1, EVDEV_MT_SLOTS_MAX);
+			slots = EVDEV_MT_SLOTS_MAX;
+		}
+	}
+
+	words = NBITS(slots);
+	device->mt.x = calloc(1, 2 * slots * sizeof(int32_t) +
+			      3 * words * sizeof(unsigned long));
+	if (device->mt.x == NULL)
+		return -1;
+
+	device->mt.slots = slots;
+	device->mt.down = (unsigned long *) (device->mt.x + 2 * slots);
+	device->mt.motion = device->mt.down + words;
+	device->mt.up = device->mt.motion + words;
+	device->mt.y = device->mt.x + slots;
+
+	return 0;
+}
+
 static int
 evdev_handle_device(struct evdev_device *device)
 {
@@ -431,7 +670,8 @@ evdev_handle_device(struct evdev_device *device)
 			device->abs.max_y = absinfo.maximum;
 			device->caps |= EVDEV_MOTION_ABS;
 		}
-		if (TEST_BIT(abs_bits, ABS_MT_SLOT)) {
+		if (TEST_BIT(abs_bits, ABS_MT_POSITION_X) &&
+		    TEST_BIT(abs_bits, ABS_MT_POSITION_Y)) {
 			ioctl(device->fd, EVIOCGABS(ABS_MT_POSITION_X),
 			      &absinfo);
 			device->abs.min_x = absinfo.minimum;
@@ -443,6 +683,22 @@ evdev_handle_device(struct evdev_device *device)
 			device->is_mt = 1;
 			device->mt.slot = 0;
 			device->caps |= EVDEV_TOUCH;
+
+			/* protocol A devices need mtdev for slots */
+			if (!TEST_BIT(abs_bits, ABS_MT_SLOT)) {
+				device->mtdev = mtdev_new_open(device->fd);
+				if (!device->mtdev) {
+					weston_log("mtdev required but failed to open for %s\n",
+						   device->devnode);
+					return 0;
+				}
+			}
+
+			if (evdev_mt_init(device, abs_bits) < 0) {
+				weston_log("no memory for the touch slots of %s\n",
+					   device->devnode);
+				return 0;
+			}
 		}
 	}
 	if (TEST_BIT(ev_bits, EV_REL)) {
@@ -548,6 +804,9 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 	device->devname = strdup(devname);
 
 	if (!evdev_handle_device(device)) {
+		if (device->mtdev)
+			mtdev_close_delete(device->mtdev);
+		free(device->mt.x);
 		free(device->devnode);
 		free(device->devname);
 		free(device);
@@ -562,13 +821,7 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 		device->dispatch = fallback_dispatch_create();
 	if (device->dispatch == NULL)
 		goto err1;
-
-
-	if (device->is_mt) {
-		device->mtdev = mtdev_new_open(device->fd);
-		if (!device->mtdev)
-			weston_log("mtdev failed to open for %s\n", path);
-	}
+	evdev_pick_process(device);
 
 	device->source = wl_event_loop_add_fd(ec->input_loop, device->fd,
 					      WL_EVENT_READABLE,
@@ -581,12 +834,29 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 err2:
 	device->dispatch->interface->destroy(device->dispatch);
 err1:
+	if (device->mtdev)
+		mtdev_close_delete(device->mtdev);
+	free(device->mt.x);
 	free(device->devname);
 	free(device->devnode);
 	free(device);
 	return NULL;
 }
 
+/* calibration is a 2x3 matrix applied to output pixels, NULL for none */
+void
+evdev_device_set_calibration(struct evdev_device *device,
+			     const float *calibration)
+{
+	device->abs.apply_calibration = calibration != NULL;
+	if (calibration)
+		memcpy(device->abs.calibration, calibration,
+		       sizeof device->abs.calibration);
+
+	/* recomputed at the next report */
+	device->abs.transform_valid = 0;
+}
+
 void
 evdev_device_destroy(struct evdev_device *device)
 {
@@ -601,6 +871,7 @@ evdev_device_destroy(struct evdev_device *device)
 	if (device->mtdev)
 		mtdev_close_delete(device->mtdev);
 	close(device->fd);
+	free(device->mt.x);
 	free(device->devname);
 	free(device->devnode);
 	free(device);
@@ -26,7 +26,10 @@
 #include <linux/input.h>
 #include <wayland-util.h>
 
+/* slots of the devices without ABS_MT_SLOT, which mtdev gives slots */
 #define MAX_SLOTS 16
+/* bound on the ABS_MT_SLOT maximum taken from a device */
+#define EVDEV_MT_SLOTS_MAX 1024
 
 enum evdev_event_type {
 	EVDEV_ABSOLUTE_MOTION = (1 << 0),
@@ -56,16 +59,31 @@ struct evdev_device {
 	int fd;
 	struct {
 		int min_x, max_x, min_y, max_y;
-		int32_t x, y;
+		int32_t x, y;		/* device units */
 
 		int apply_calibration;
 		float calibration[6];
+
+		/* device units less the minimum to output pixels, range
+		 * scaling, output offset and calibration in one 32.32 fixed
+		 * point affine transform, made for the output geometry in
+		 * made_for (x, y, width, height) if transform_valid */
+		int64_t transform[6];
+		int32_t made_for[4];
+		int transform_valid;
 	} abs;
 
 	struct {
 		int slot;
-		int32_t x[MAX_SLOTS];
-		int32_t y[MAX_SLOTS];
+		int slots;		/* ABS_MT_SLOT maximum + 1 */
+		int32_t *x;		/* device units */
+		int32_t *y;
+		/* the slots changed since the last SYN_REPORT, a bit each,
+		 * of NBITS(slots) longs, one after the other; x points to
+		 * the one allocation */
+		unsigned long *down;
+		unsigned long *motion;
+		unsigned long *up;
 	} mt;
 	struct mtdev *mtdev;
 
@@ -76,6 +94,12 @@ struct evdev_device {
 	enum evdev_event_type pending_events;
 	enum evdev_device_capability caps;
 
+	/* processes what was read, picked for the capabilities once the
+	 * dispatch is known */
+	uint32_t (*process_events)(struct evdev_device *device,
+				   struct input_event *ev, int count,
+				   uint32_t time);
+
 	int is_mt;
 };
 
@@ -120,6 +144,10 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd);
 void
 evdev_device_destroy(struct evdev_device *device);
 
+void
+evdev_device_set_calibration(struct evdev_device *device,
+			     const float *calibration);
+
 void
 evdev_notify_keyboard_focus(struct weston_seat *seat,
 			    struct wl_list *evdev_devices);
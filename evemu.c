@@ -401,6 +401,173 @@ int evemu_read_event(FILE *fp, struct input_event *ev)
 	return ret;
 }
 
+#define EVEMU_STREAM_BLOCK	65536
+#define EVEMU_STREAM_LINE	128
+
+struct evemu_stream {
+	int fd;
+	int eof;
+	size_t pos, len;
+	char buf[EVEMU_STREAM_BLOCK];
+};
+
+struct evemu_stream *evemu_stream_new(int fd)
+{
+	struct evemu_stream *s = malloc(sizeof(*s));
+
+	if (s) {
+		s->fd = fd;
+		s->eof = 0;
+		s->pos = s->len = 0;
+	}
+
+	return s;
+}
+
+void evemu_stream_delete(struct evemu_stream *s)
+{
+	if (s == NULL)
+		return;
+	close(s->fd);
+	free(s);
+}
+
+/* keep at least one whole line buffered unless at end of file */
+static void stream_fill(struct evemu_stream *s)
+{
+	ssize_t ret;
+
+	if (s->eof || s->len - s->pos >= EVEMU_STREAM_LINE)
+		return;
+
+	memmove(s->buf, s->buf + s->pos, s->len - s->pos);
+	s->len -= s->pos;
+	s->pos = 0;
+
+	while (!s->eof && s->len < sizeof(s->buf)) {
+		SYSCALL(ret = read(s->fd, s->buf + s->len,
+				   sizeof(s->buf) - s->len));
+		if (ret <= 0)
+			s->eof = 1;
+		else
+			s->len += ret;
+	}
+}
+
+static inline int is_space(char c)
+{
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r' ||
+	       c == '\v' || c == '\f';
+}
+
+static inline const char *skip_space(const char *p, const char *end)
+{
+	while (p < end && is_space(*p))
+		p++;
+	return p;
+}
+
+static inline int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/* scanf "%<width>u" without the locale machinery */
+static inline const char *scan_dec(const char *p, const char *end,
+				   int width, unsigned long *out)
+{
+	const char *start = p;
+	unsigned long v = 0;
+
+	while (p < end && width-- > 0 && *p >= '0' && *p <= '9')
+		v = v * 10 + (*p++ - '0');
+
+	*out = v;
+	return p == start ? NULL : p;
+}
+
+/* scanf "%04x" */
+static inline const char *scan_hex4(const char *p, const char *end,
+				    unsigned *out)
+{
+	const char *start = p;
+	unsigned v = 0;
+	int width = 4, d;
+
+	while (p < end && width-- > 0 && (d = hex_digit(*p)) >= 0) {
+		v = (v << 4) | d;
+		p++;
+	}
+
+	*out = v;
+	return p == start ? NULL : p;
+}
+
+/* one "E: %lu.%06u %04x %04x %d" line, returns the end of the line */
+static const char *scan_event(const char *p, const char *end,
+			      struct input_event *ev)
+{
+	unsigned long sec, usec, value;
+	unsigned type, code;
+	int neg = 0;
+
+	if (end - p < 2 || p[0] != 'E' || p[1] != ':')
+		return NULL;
+
+	p = skip_space(p + 2, end);
+	if (!(p = scan_dec(p, end, 20, &sec)))
+		return NULL;
+	if (p >= end || *p++ != '.')
+		return NULL;
+	if (!(p = scan_dec(p, end, 6, &usec)))
+		return NULL;
+	p = skip_space(p, end);
+	if (!(p = scan_hex4(p, end, &type)))
+		return NULL;
+	p = skip_space(p, end);
+	if (!(p = scan_hex4(p, end, &code)))
+		return NULL;
+	p = skip_space(p, end);
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = (*p++ == '-');
+	if (!(p = scan_dec(p, end, 11, &value)))
+		return NULL;
+
+	ev->time.tv_sec = sec;
+	ev->time.tv_usec = usec;
+	ev->type = type;
+	ev->code = code;
+	ev->value = (int)(neg ? 0u - (unsigned)value : (unsigned)value);
+
+	return skip_space(p, end);
+}
+
+int evemu_stream_read_events(struct evemu_stream *s, struct input_event *ev,
+			     int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		const char *p, *next;
+
+		stream_fill(s);
+		p = skip_space(s->buf + s->pos, s->buf + s->len);
+		next = scan_event(p, s->buf + s->len, &ev[i]);
+		if (next == NULL) {
+			s->pos = p - s->buf;
+			break;
+		}
+		s->pos = next - s->buf;
+	}
+
+	return i;
+}
+
 int evemu_read_event_realtime(FILE *fp, struct input_event *ev,
 			      struct timeval *evtime)
 {
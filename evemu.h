@@ -326,6 +326,40 @@ int evemu_write_event(FILE *fp, const struct input_event *ev);
  */
 int evemu_read_event(FILE *fp, struct input_event *ev);
 
+/**
+ * evemu_stream_new() - open a block buffered event reader
+ * @fd: file descriptor of an evemu event file, owned by the stream
+ *
+ * The stream decodes "E:" lines without stdio, reading the file in
+ * large blocks. No memory is allocated after this call.
+ *
+ * Returns NULL in case of memory failure.
+ */
+struct evemu_stream *evemu_stream_new(int fd);
+
+/**
+ * evemu_stream_delete() - close an event reader
+ * @s: the stream to close, may be NULL
+ *
+ * Closes the file descriptor and frees the stream.
+ */
+void evemu_stream_delete(struct evemu_stream *s);
+
+/**
+ * evemu_stream_read_events() - read a batch of kernel events
+ * @s: the stream to read from
+ * @ev: array to be filled with the events
+ * @count: number of events wanted
+ *
+ * Decodes up to count events, accepting the same input as
+ * evemu_read_event().
+ *
+ * Returns the number of events decoded, less than count at end of
+ * file or on a malformed line.
+ */
+int evemu_stream_read_events(struct evemu_stream *s, struct input_event *ev,
+			     int count);
+
 /**
  * evemu_read_event_realtime() - read kernel events in realtime
  * @fp: file pointer to read the event from
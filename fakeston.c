@@ -15,8 +15,10 @@
  * with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <dlfcn.h>
@@ -24,6 +26,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include "wayland-server-protocol.h"
 #include "compositor.h"
@@ -31,555 +35,914 @@
 #include "evemu-impl.h"
 #include "fakeston.h"
 
-size_t hash_seek(void ** table, size_t cnt, size_t item_size, void *ptr, void *seek)
+void usage()
 {
-	uintptr_t *tb;
-	size_t off = (uintptr_t)ptr ^ ((uintptr_t)ptr >> 16) ^ (uintptr_t) 0x752ece3898c734a9;
-	size_t offx = cnt + off;
+	fprintf(stderr, "fakeston_run [-c out.fbin] [-p] [-b] [-e golden] [-j N] [-s X] [-P[out.csv]] [-a [device=]accel]... ftestcase.txt|dir ...\n\n"
+		" ftestcase.txt - the test case file, text or compiled\n"
+		" dir - replay every ftestcase*.txt and *.fbin in it\n"
+		" -c, --compile out.fbin - compile the test case, do not replay\n"
+		" -p, --pipe - feed events through a pipe instead of memory\n"
+		" -b, --binary - write binary notify records instead of text\n"
+		" -e, --expect golden - compare the notify records with a golden\n"
+		"                       -b output, stop at the first difference\n"
+		" -j, --jobs N - replay N test cases at a time\n"
+		" -s, --speed X - pace the bursts as captured, X times faster;\n"
+		"                 0 replays as fast as possible (default)\n"
+		" -P, --profile[=out.csv] - print where the replay spent its time,\n"
+		"                           and the stage times of every burst\n"
+		"                           to out.csv\n"
+		" -a, --accel [device=]accel - pointer acceleration of the\n"
+		"                devices whose name contains device (of all\n"
+		"                without it): touchpad, flat:F,\n"
+		"                linear:S[:MIN:MAX], table:V=F,... or\n"
+		"                spline:V=F,...; the first match counts\n");
+}
 
-	do {
-		tb = (uintptr_t *) ((char *) table + (++off % cnt) * item_size);
-	} while ((*tb != (uintptr_t) seek) && (off != offx));
 
-	return off == offx ? cnt : off % cnt;
-}
 
-void usage()
-{
-	fprintf(stderr, "fakeston_run ftestcase.txt \n\n ftestcase.txt - the test case file\n");
-}
 
+/*
+ * Fake device fds. Every device reserves a real fd on /dev/null, so that
+ * no other fd of the process can have its number, and registers it here.
+ * The interposed ioctl/read/close serve the registered fds and pass every
+ * other fd on to libc, so any number of ploads can replay at once in one
+ * process, next to whatever fds the host has open.
+ */
+#define FAKESTON_FD_CHUNK 4096
 
-void try_free(char** x)
-{
-	if (*x != NULL){
-		free(*x);
-		*x = NULL;
-	}
-}
+static struct fakeston_evdev_dev **fakeston_fds[FAKESTON_FD_MAX /
+						FAKESTON_FD_CHUNK];
+static pthread_mutex_t fakeston_fds_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void try_replace_n(char** x, const char *y, size_t n)
+static int fakeston_fd_open(struct fakeston_evdev_dev *d)
 {
-	try_free(x);
-	*x = malloc(n);
-	if (*x)
-		memcpy(*x, y, n);
-}
+	struct fakeston_evdev_dev **chunk;
+	int fd;
 
+	fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fd >= FAKESTON_FD_MAX) {
+		close(fd);
+		return -1;
+	}
 
-static void read_prop(struct evemu_device *dev, FILE *fp)
-{
-	unsigned int mask[8];
-	int i;
-	while (fscanf(fp, "P: %02x %02x %02x %02x %02x %02x %02x %02x\n",
-		      mask + 0, mask + 1, mask + 2, mask + 3,
-		      mask + 4, mask + 5, mask + 6, mask + 7) > 0) {
-		for (i = 0; i < 8; i++)
-			dev->prop[dev->pbytes++] = mask[i];
+	pthread_mutex_lock(&fakeston_fds_lock);
+	chunk = fakeston_fds[fd / FAKESTON_FD_CHUNK];
+	if (chunk == NULL) {
+		chunk = calloc(FAKESTON_FD_CHUNK, sizeof(*chunk));
+		if (chunk != NULL)
+			__atomic_store_n(&fakeston_fds[fd / FAKESTON_FD_CHUNK],
+					 chunk, __ATOMIC_RELEASE);
 	}
-}
+	pthread_mutex_unlock(&fakeston_fds_lock);
 
-static void read_mask(struct evemu_device *dev, FILE *fp)
-{
-	unsigned int mask[8];
-	int index, i;
-	while (fscanf(fp, "B: %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
-		      &index, mask + 0, mask + 1, mask + 2, mask + 3,
-		      mask + 4, mask + 5, mask + 6, mask + 7) > 0) {
-		for (i = 0; i < 8; i++)
-			dev->mask[index][dev->mbytes[index]++] = mask[i];
+	if (chunk == NULL) {
+		close(fd);
+		return -1;
 	}
-}
 
-static void read_abs(struct evemu_device *dev, FILE *fp)
-{
-	struct input_absinfo abs;
-	int index;
-	while (fscanf(fp, "A: %02x %d %d %d %d\n", &index,
-		      &abs.minimum, &abs.maximum, &abs.fuzz, &abs.flat) > 0)
-		dev->abs[index] = abs;
-}
+	d->fd = fd;
+	__atomic_store_n(&chunk[fd % FAKESTON_FD_CHUNK], d, __ATOMIC_RELEASE);
 
-int evemu_has_event(const struct evemu_device *dev, int type, int code);
+	return 0;
+}
 
-void fakeston_evdev_dev_load_desc(struct fakeston_evdev_dev *device, FILE *fp)
+/* the chunks stay, they are reused by the next fds */
+static void fakeston_fd_close(struct fakeston_evdev_dev *d)
 {
+	struct fakeston_evdev_dev **chunk = fakeston_fds[d->fd / FAKESTON_FD_CHUNK];
 
-	struct evemu_device dev;
-
-	memset(&dev, 0, sizeof(dev));
+	__atomic_store_n(&chunk[d->fd % FAKESTON_FD_CHUNK], NULL,
+			 __ATOMIC_RELEASE);
+	/* no longer registered, this goes to libc */
+	close(d->fd);
+	d->fd = -1;
+}
 
-	struct input_id id;
+static struct fakeston_evdev_dev *fakeston_fd_dev(int fd)
+{
+	struct fakeston_evdev_dev **chunk;
 
-	unsigned bustype, vendor, product, version;
-	int ret;
-	char name[85];
-	memset(name, 0, sizeof(name));
-	ret = fscanf(fp, "N: %79[^\n]\n", name);
-	if (ret <= 0)
-		return;
+	if ((unsigned int) fd >= FAKESTON_FD_MAX)
+		return NULL;
 
+	chunk = __atomic_load_n(&fakeston_fds[fd / FAKESTON_FD_CHUNK],
+				__ATOMIC_ACQUIRE);
+	if (chunk == NULL)
+		return NULL;
 
-	try_replace_n(&device->ioctl_EVIOCGNAME, name, strlen(name) + 1);
+	return __atomic_load_n(&chunk[fd % FAKESTON_FD_CHUNK], __ATOMIC_ACQUIRE);
+}
 
+struct pload *fakeston_ctx_from_fd(int fd)
+{
+	struct fakeston_evdev_dev *d = fakeston_fd_dev(fd);
 
+	return d ? d->p : NULL;
+}
 
-	ret = fscanf(fp, "I: %04x %04x %04x %04x\n",
-		     &bustype, &vendor, &product, &version);
-	id.bustype = bustype;
-	id.vendor = vendor;
-	id.product = product;
-	id.version = version;
+/* the device of a fake fd, if it belongs to p */
+struct fakeston_evdev_dev *fakeston_ctx_dev(struct pload *p, int fd)
+{
+	struct fakeston_evdev_dev *d = fakeston_fd_dev(fd);
 
-	try_replace_n(&device->ioctl_EVIOCGID, (char *) &id, sizeof(id));
+	return (d && (d->p == p)) ? d : NULL;
+}
 
-	dev.pbytes = 0;
-	read_prop(&dev, fp);
-	device->pbytes = dev.pbytes;
+struct pload *fakeston_ctx_from_seat(struct weston_seat *seat)
+{
+	return container_of(seat->compositor, struct pload, comp);
+}
 
-	try_replace_n(&device->ioctl_EVIOCGPROP, (char *) dev.prop, dev.pbytes);
+/*
+ * weston_log() and friends carry no seat or fd, they log into the pload
+ * whose evdev call is running on this thread.
+ */
+__thread struct pload *fixed_p = NULL;
 
-	read_mask(&dev, fp);
-	int index;
-	for (index = 0; index < 32; index++) {
-		if (dev.mbytes[index] == 0)
-			continue;
+int fakeston_vlog(const char *fmt, va_list ap)
+{
+	if (fixed_p == NULL)
+		return vfprintf(stdout, fmt, ap);
 
-		char **chlievik = &(device->ioctl_EVIOCGBIT_EV_BITS[index]);
-		char *src = (char *)&(dev.mask[index]);
+	fakeston_prof_enter(FAKESTON_STAGE_OUTPUT);
+	fixed_p->sink->interface->log(fixed_p->sink, fmt, ap);
+	fakeston_prof_leave();
+	return 0;
+}
 
-		size_t bb = device->bitsbytes[index] = dev.mbytes[index];
-		try_replace_n(chlievik, src, bb);
+void fakeston_notify(struct weston_seat *seat, struct fakeston_notify_rec *n)
+{
+	struct pload *p = fakeston_ctx_from_seat(seat);
 
-		src = *chlievik;
+	fakeston_prof_enter(FAKESTON_STAGE_OUTPUT);
+	n->seat = container_of(seat, struct fakeston_evdev_seat, whatever)->id;
+	p->sink->interface->notify(p->sink, seat, n);
+	fakeston_prof_leave();
+}
 
-	}
+static const char *fakeston_dump_names[FAKESTON_DUMP_CNT] = {
+	[FAKESTON_DUMP_KEY_BITS] = "key_bits",
+	[FAKESTON_DUMP_EVDEV_KEYS] = "evdev_keys",
+	[FAKESTON_DUMP_REL_BITS] = "rel_bits",
+	[FAKESTON_DUMP_ABS_X] = "eviocgabs_abs_x",
+	[FAKESTON_DUMP_ABS_Y] = "eviocgabs_abs_y",
+	[FAKESTON_DUMP_MT_POS_X] = "eviocgabs_abs_mt_pos_x",
+	[FAKESTON_DUMP_MT_POS_Y] = "eviocgabs_abs_mt_pos_y",
+	[FAKESTON_DUMP_ABS_PRESSURE] = "eviocg_abs_pressure",
+	[FAKESTON_DUMP_ABS_BITS] = "abs_bits",
+};
+
+static int fakeston_dump_type(const char *type)
+{
+	int i;
+	for (i = 0; i < FAKESTON_DUMP_CNT; i++)
+		if (0 == strcmp(type, fakeston_dump_names[i]))
+			return i;
+	return -1;
+}
 
+/* try the name as is, then next to the test case file */
+static int fakeston_open_aside(const char *subfolder, const char *fname)
+{
+	int fd = open(fname, O_RDONLY | O_CLOEXEC);
 
-	read_abs(&dev, fp);
+	if (fd < 0) {
+		char bfname[1024] = {0};
 
-	for (index = 0; index < 64; index++) {
+		snprintf(bfname, sizeof(bfname), "%s/%s", subfolder, fname);
 
-		if (!evemu_has_event(&dev, EV_ABS, index)) {
+		fd = open(bfname, O_RDONLY | O_CLOEXEC);
 
-			continue;
-		}
+		if (fd < 0)
+			fprintf(stderr, "cannot find . %s . \n", bfname);
+	}
+	return fd;
+}
 
-		char **chlievik = &(device->ioctl_EVIOCGBIT_EV_ABS[index]);
+static struct fakeston_evdev_src *
+fakeston_decoder_src(struct fakeston_decoder *dec, void *id)
+{
+	return fakeston_map_get(&dec->t, (uintptr_t) id);
+}
 
-		struct input_absinfo *aa = &dev.abs[index];
+static uint32_t
+fakeston_decoder_slot(struct fakeston_decoder *dec, void *id)
+{
+	struct fakeston_evdev_src *src = fakeston_decoder_src(dec, id);
 
-		try_replace_n(chlievik, (char *)aa, sizeof(struct input_absinfo));
+	return src ? src->slot : FAKESTON_SLOT_NONE;
+}
 
-		device->is_abs |= 1<<index;
+/* the free list must be able to take back every slot handed out */
+static int
+fakeston_decoder_reserve(struct fakeston_decoder *dec)
+{
+	uint32_t *freeslot;
+	size_t cap;
 
+	if (dec->nfree || (dec->nslot < dec->freecap))
+		return 0;
+	if (dec->nslot >= FAKESTON_SLOT_MAX)
+		return -1;
 
+	cap = dec->freecap ? dec->freecap * 2 : 64;
+	freeslot = realloc(dec->freeslot, cap * sizeof(*freeslot));
+	if (freeslot == NULL)
+		return -1;
+	dec->freeslot = freeslot;
+	dec->freecap = cap;
 
-	}
+	return 0;
+}
 
+static void fakeston_decoder_src_free(void *val, void *data)
+{
+	struct fakeston_evdev_src *src = val;
 
+	evemu_stream_delete(src->evt);
+	free(src->ev);
+	free(src);
 }
 
-int evemu_read_event(FILE *fp, struct input_event *ev);
+static void fakeston_decode(struct fakeston_decoder *dec, char *tag, FILE *tcase)
+{
+	struct fakeston_bin_rec rec;
+	struct fakeston_evdev_src *src;
+	const struct fakeston_desc *desc = NULL;
+	const void *payload = NULL;
 
-struct pload *fixed_p = NULL;
+	memset(&rec, 0, sizeof(rec));
 
-void fakeston_line_handler(void*data, char*tag, FILE *tcase)
-{
-	struct pload *p = ( struct pload *) data;
-	struct fakeston_evdev_dev *d = (struct fakeston_evdev_dev *) p->d;
-	struct fakeston_evdev_seat *s = (struct fakeston_evdev_seat *) p->s;
-	struct fakeston_evdev_rev *r = (struct fakeston_evdev_rev *) p->r;
-	struct fakeston_evdev_rev *z = (struct fakeston_evdev_rev *) p->z;
-	size_t doff, soff, roff, zoff;
-	size_t sitem_s = sizeof(struct fakeston_evdev_seat);
-	size_t ditem_s = sizeof(struct fakeston_evdev_dev);
-	size_t ritem_s = sizeof(struct fakeston_evdev_rev);
 	if (0 == strcmp(tag, "seatfocus:")) {
 		void *id;
 
 		fscanf(tcase, "%p", &id);
 
-		soff = hash_seek((void*)s, p->shtsz, sitem_s,  id, id);
-		if (soff == p->shtsz) {
-			return;
-		}
-		fixed_p = p;
+		rec.op = FAKESTON_OP_SEATFOCUS;
+		rec.id = (uintptr_t) id;
+		rec.slot = FAKESTON_SLOT_NONE;
+	} else if (0 == strcmp(tag, "EcreateDEV:")) {
+		void *id;
 
-		evdev_notify_keyboard_focus(&s[soff].whatever, &p->devices_list);
+		fscanf(tcase, "%p", &id);
 
-		fixed_p = NULL;
-	} else
-	if (0 == strcmp(tag, "EcreateDEV:")) {
+		rec.op = FAKESTON_OP_CREATE;
+		rec.id = (uintptr_t) id;
+		rec.slot = fakeston_decoder_slot(dec, id);
+	} else if (0 == strcmp(tag, "EprepareDEV:")) {
 		void *id, *seatid;
 
+		fscanf(tcase, "%p %p", &id, &seatid);
+
+		src = fakeston_decoder_src(dec, id);
+		if (src == NULL) {
+			if (fakeston_decoder_reserve(dec) < 0)
+				return;
+
+			src = calloc(1, sizeof(*src));
+			if (src == NULL)
+				return;
+			src->id = (uintptr_t) id;
+			if (fakeston_map_put(&dec->t, src->id, src) < 0) {
+				free(src);
+				return;
+			}
+			/* reuse the slot of a destroyed device first */
+			src->slot = dec->nfree ? dec->freeslot[--dec->nfree] :
+						 dec->nslot++;
+		}
+
+		rec.op = FAKESTON_OP_PREPARE;
+		rec.slot = src->slot;
+		rec.id = (uintptr_t) id;
+		rec.aux = (uintptr_t) seatid;
+	} else if (0 == strcmp(tag, "EdestroyDEV:")) {
+		void *id;
 		fscanf(tcase, "%p", &id);
 
-		doff = hash_seek((void*)d, p->dhtsz, ditem_s,  id, id);
-		if (doff == p->dhtsz) {
-			return;
+		rec.slot = FAKESTON_SLOT_NONE;
+
+		src = fakeston_map_del(&dec->t, (uintptr_t) id);
+		if (src) {
+			rec.slot = src->slot;
+			/* holds every slot, cannot fail to grow */
+			dec->freeslot[dec->nfree++] = src->slot;
+			fakeston_decoder_src_free(src, NULL);
 		}
 
-		seatid = (void *) d[doff].seatid;
+		rec.op = FAKESTON_OP_DESTROY;
+		rec.id = (uintptr_t) id;
+	} else if (0 == strcmp(tag, "IOCTLDUMP:")) {
+		void *id;
+		char type[128] = {0};
+		size_t siz, i;
 
-		soff = hash_seek((void*)s, p->shtsz, sitem_s,  seatid, seatid);
-		if (soff == p->shtsz) {
-			return;
+		fscanf(tcase, "%p %127s %zu", &id, type, &siz);
+
+		for (i = 0; i < siz; i++) {
+			unsigned int tmp;
+			fscanf(tcase, "%02x", &tmp);
+			if (i < sizeof(dec->blob))
+				dec->blob[i] = tmp;
 		}
 
-		int dev_fd = d[doff].fd;
+		int dump = fakeston_dump_type(type);
+		if (dump < 0)
+			return;
 
-		fixed_p = p;
+		rec.op = FAKESTON_OP_IOCTLDUMP;
+		rec.id = (uintptr_t) id;
+		rec.slot = fakeston_decoder_slot(dec, id);
+		rec.arg = dump;
+		rec.size = siz < sizeof(dec->blob) ? siz : sizeof(dec->blob);
+		payload = dec->blob;
+	} else if (0 == strcmp(tag, "Erecd:")) {
+		void *id;
+		char fname[128] = {0};
+		int orig_rand = -1;
+		int fd;
+		fscanf(tcase, "%p %127s", &id, fname);
+		sscanf(fname, "evemucase%i.txt", &orig_rand);
 
-		struct evdev_device *device = evdev_device_create(&s[soff].whatever, "<mock-dev-path>", dev_fd);
+		src = fakeston_decoder_src(dec, id);
+		if (src == NULL)
+			return;
 
-		fixed_p = NULL;
+		fd = fakeston_open_aside(dec->subfolder, fname);
+		if (fd < 0)
+			return;
 
-		if ((device == NULL) || (device == EVDEV_UNHANDLED_DEVICE)) {
-			fprintf(stdout, "FAKESTON: ERR: Cannot create device %p. \n", id);
+		evemu_stream_delete(src->evt);
+		src->evt = evemu_stream_new(fd);
+		if (src->evt == NULL) {
+			close(fd);
 			return;
 		}
 
-		d[doff].device = device;
-		d[doff].device->output = p->output;
-		d[doff].device->abs.max_x = 1024;
-		d[doff].device->abs.max_y = 768;
-		d[doff].device->abs.min_x = 0;
-		d[doff].device->abs.min_y = 0;
-		d[doff].created = 1;
+		rec.op = FAKESTON_OP_RECD;
+		rec.id = (uintptr_t) id;
+		rec.slot = src->slot;
+		rec.arg = orig_rand;
+	} else if (0 == strcmp(tag, "Edesc:")) {
+		void *id;
+		char fname[128] = {0};
+		int orig_fd = -1;
+		int fd;
+		fscanf(tcase, "%p %127s", &id, fname);
+		sscanf(fname, "evemudesc%i.txt", &orig_fd);
 
-		wl_list_insert(&p->devices_list, &d[doff].device->link);
+		fd = fakeston_open_aside(dec->subfolder, fname);
+		if (fd < 0)
+			return;
 
+		desc = fakeston_desc_load(fd);
+		close(fd);
 
-	} else if (0 == strcmp(tag, "EprepareDEV:")) {
-		void *id, *seatid, *seatptr;
+		rec.op = FAKESTON_OP_DESC;
+		rec.id = (uintptr_t) id;
+		rec.slot = fakeston_decoder_slot(dec, id);
+		rec.arg = orig_fd;
+		if (desc) {
+			rec.size = sizeof(desc->dev);
+			payload = &desc->dev;
+		}
+	} else if (0 == strcmp(tag, "EnewBURST:")) {
+		int got;
+		void *id;
+		unsigned long a, b, c, n;
+		fscanf(tcase, "%lu %lu.%lu %p %lu", &a, &b, &c, &id, &n);
 
-		fscanf(tcase, "%p %p", &id, &seatid);
+		src = fakeston_decoder_src(dec, id);
+		if (src == NULL || src->evt == NULL)
+			return;
 
-		doff = hash_seek((void*)d, p->dhtsz, ditem_s,  id, id);
-		if (doff != p->dhtsz) {
+		if (n > UINT32_MAX / sizeof(struct input_event)) {
+			fprintf(stderr, "error: too big burst\n");
 			return;
 		}
-		doff = hash_seek((void*)d, p->dhtsz, ditem_s,  id, 0);
 
-		soff = hash_seek((void*)s, p->shtsz, sitem_s,  seatid, seatid);
-		if (soff == p->shtsz) {
-			soff = hash_seek((void*)s, p->shtsz, sitem_s,  seatid, 0);
-			if (soff == p->shtsz)
-				return;
-
-			s[soff].id = (uintptr_t) seatid;
-			s[soff].whatever.compositor = &p->comp;
-			s[soff].whatever.keyboard = (void *) &p->k;
+		if (n > src->evcap) {
+			size_t cap = src->evcap ? src->evcap : 64;
+			struct input_event *ev;
 
+			while (cap < n)
+				cap *= 2;
+			ev = realloc(src->ev, cap * sizeof(*ev));
+			if (ev == NULL) {
+				fprintf(stderr, "error: no memory for burst of %lu\n", n);
+				return;
+			}
+			src->ev = ev;
+			src->evcap = cap;
 		}
 
-		seatptr = &s[soff].whatever;
-
-		int dev_fd = p->fd_seq++;
-
-		roff = hash_seek((void*)r, p->dhtsz, ritem_s, (void*)(intptr_t)dev_fd, 0);
-		zoff = hash_seek((void*)z, p->shtsz, ritem_s, seatptr, seatptr);
-		if (zoff == p->shtsz) {
-			zoff = hash_seek((void*)z, p->shtsz, ritem_s, seatptr, 0);
+		fakeston_prof_enter(FAKESTON_STAGE_DECODE);
+		got = evemu_stream_read_events(src->evt, src->ev, n);
+		fakeston_prof_leave();
+		if ((unsigned long) got < n) {
+			fprintf(stderr, "error: short burst of %p, %d of %lu "
+				"events\n", id, got, n);
+			if (got <= 0)
+				return;
+			n = got;
 		}
 
+		rec.op = FAKESTON_OP_BURST;
+		rec.id = (uintptr_t) id;
+		rec.slot = src->slot;
+		rec.aux = a;
+		rec.sec = b;
+		rec.usec = c;
+		rec.arg = n;
+		rec.size = n * sizeof(src->ev[0]);
+		payload = src->ev;
+	} else {
+		return;
+	}
 
-		z[zoff].id = (uintptr_t)(intptr_t) &s[soff].whatever;
-		z[zoff].off = soff;
-
-		r[roff].id = (uintptr_t)(intptr_t) dev_fd;
-		r[roff].off = doff;
-
-		d[doff].id = (uintptr_t) id;
-		d[doff].seatid = (uintptr_t) seatid;
-		d[doff].init_serial = p->seq++;
-		d[doff].device = NULL;
-		d[doff].fd = dev_fd;
+	dec->emit(dec->data, &rec, payload);
 
-		d[doff].created = 0;
+	fakeston_desc_put(desc);
+}
 
-	} else if (0 == strcmp(tag, "EdestroyDEV:")) {
-		void *id;
-		fscanf(tcase, "%p", &id);
+int fakeston_line_handler(void*data, char*tag, FILE *tcase)
+{
+	struct fakeston_decoder *dec = (struct fakeston_decoder *) data;
 
-		doff = hash_seek((void *)d, p->dhtsz, ditem_s,  id, id);
-		if (doff == p->dhtsz)
-			return;
+	fakeston_decode(dec, tag, tcase);
 
-		if (d[doff].created) {
-			fixed_p = p;
-			evdev_device_destroy(d[doff].device);
-			fixed_p = NULL;
-			d[doff].created = 0;
-		}
+	return dec->stop ? *dec->stop : 0;
+}
 
-		d[doff].created = 0;
+static void fakeston_op_seatfocus(struct pload *p, void *id)
+{
+	struct fakeston_evdev_seat *s;
 
-		d[doff].id = (uintptr_t) 0;
-		if (d[doff].evt) {
-			fclose(d[doff].evt);
-		}
+	s = fakeston_map_get(&p->s, (uintptr_t) id);
+	if (s == NULL) {
+		return;
+	}
+	fixed_p = p;
 
-		try_free(&d[doff].ioctl_eviocgabs_abs_x);
-		try_free(&d[doff].ioctl_eviocgabs_abs_y);
-		try_free(&d[doff].ioctl_eviocgabs_abs_mt_pos_x);
-		try_free(&d[doff].ioctl_eviocgabs_abs_mt_pos_y);
-
-		try_free(&d[doff].ioctl_EVIOCGNAME);
-		try_free(&d[doff].ioctl_EVIOCGID);
-		try_free(&d[doff].ioctl_EVIOCGPROP);
-		try_free(&d[doff].ioctl_EVIOCGKEY);
-		int slot;
-		for (slot = 0; slot < 32; slot++)
-			try_free(&(d[doff].ioctl_EVIOCGBIT_EV_BITS[slot]));
-		try_free(&d[doff].ioctl_EVIOCGBIT_EV_KEY);
-		try_free(&d[doff].ioctl_EVIOCGBIT_EV_REL);
-		try_free(&d[doff].ioctl_EVIOCGBIT_EV_ABS_REAL);
-		for (slot = 0; slot < 64; slot++)
-			try_free(&(d[doff].ioctl_EVIOCGBIT_EV_ABS[slot]));
+	evdev_notify_keyboard_focus(&s->whatever, &p->devices_list);
 
-	} else if (0 == strcmp(tag, "IOCTLDUMP:")) {
-		void *id;
-		char type[128] = {0};
-		char baf[1024] = {0};
-		size_t siz;
+	fixed_p = NULL;
+}
 
-		fscanf(tcase, "%p %127s %zu", &id, type, &siz);
+extern struct evdev_dispatch_interface touchpad_interface;
 
-		doff = hash_seek((void*)d, p->dhtsz, ditem_s,  id, id);
-		if (doff == p->dhtsz) {
-			return;
-		}
+static void fakeston_op_create(struct pload *p, struct fakeston_evdev_dev *d)
+{
+	struct fakeston_evdev_seat *s;
+	struct wl_event_source_fd *fdsource;
+	void *id = (void *) d->id;
 
-		size_t i;
-		for (i = 0; i < siz; i++) {
-			unsigned int tmp;
-			fscanf(tcase, "%02x", &tmp);
-			baf[i] = tmp;
-		}
+	s = fakeston_map_get(&p->s, d->seatid);
+	if (s == NULL) {
+		return;
+	}
 
-		if (0 == strcmp(type, "key_bits")) {
-			try_replace_n(&d[doff].ioctl_EVIOCGBIT_EV_KEY, baf, siz);
-			d[doff].keybytes = siz;
+	int dev_fd = d->fd;
 
-		}
+	fixed_p = p;
+	fakeston_accel_devname = d->desc ? d->desc->dev.name : NULL;
 
-		if (0 == strcmp(type, "evdev_keys")) {
-			try_replace_n(&d[doff].ioctl_EVIOCGKEY, baf, siz);
-			d[doff].EVIOCGKEYsize = siz;
+	struct evdev_device *device = evdev_device_create(&s->whatever, "<mock-dev-path>", dev_fd);
 
-		}
+	fakeston_accel_devname = NULL;
+	fixed_p = NULL;
 
+	if ((device == NULL) || (device == EVDEV_UNHANDLED_DEVICE)) {
+		fakeston_sink_log(p->sink, "FAKESTON: ERR: Cannot create device %p. \n", id);
+		return;
+	}
 
-		if ((0 == strcmp(type, "rel_bits"))) {
-			try_replace_n(&d[doff].ioctl_EVIOCGBIT_EV_REL, baf, siz);
-			d[doff].relbits = siz;
-		}
+	/* bursts call straight into the fd callback of the device */
+	fdsource = (struct wl_event_source_fd *) device->source;
 
-		if ((0 == strcmp(type, "eviocgabs_abs_x"))) {
-			try_replace_n(&d[doff].ioctl_eviocgabs_abs_x, baf, siz);
-			d[doff].size_abs_x = siz;
-		}
+	d->device = device;
+	d->func = fdsource->func;
+	d->device->output = p->output;
+	d->device->abs.max_x = 1024;
+	d->device->abs.max_y = 768;
+	d->device->abs.min_x = 0;
+	d->device->abs.min_y = 0;
+	d->created = 1;
 
-		if ((0 == strcmp(type, "eviocgabs_abs_y"))) {
-			try_replace_n(&d[doff].ioctl_eviocgabs_abs_y, baf, siz);
-			d[doff].size_abs_y = siz;
-		}
+	wl_list_insert(&p->devices_list, &d->device->link);
 
-		if ((0 == strcmp(type, "eviocgabs_abs_mt_pos_x"))) {
-			try_replace_n(&d[doff].ioctl_eviocgabs_abs_mt_pos_x, baf, siz);
-			d[doff].size_abs_mt_pos_x = siz;
-		}
+	if (fakeston_prof_cur)
+		d->prof = fakeston_prof_dev(fakeston_prof_cur, device->devname,
+			(device->dispatch->interface == &touchpad_interface) ?
+			"touchpad" : "fallback");
+}
 
-		if ((0 == strcmp(type, "eviocgabs_abs_mt_pos_y"))) {
-			try_replace_n(&d[doff].ioctl_eviocgabs_abs_mt_pos_y, baf, siz);
-			d[doff].size_abs_mt_pos_y = siz;
-		}
+static void fakeston_op_prepare(struct pload *p, uint32_t slot, void *id,
+				void *seatid)
+{
+	struct fakeston_evdev_dev *d;
+	struct fakeston_evdev_seat *s;
 
-		if ((0 == strcmp(type, "eviocg_abs_pressure"))) {
+	/* slots come from the decoder */
+	if (slot >= FAKESTON_SLOT_MAX)
+		return;
 
+	if (slot >= p->slotcap) {
+		size_t cap = p->slotcap ? p->slotcap : 64;
+		struct fakeston_evdev_dev **tab;
 
-			try_replace_n(&d[doff].ioctl_EVIOCGABS_ABS_PRESSURE, baf, siz);
-			d[doff].evabspressure = siz;
-		}
+		while (cap <= slot)
+			cap *= 2;
+		tab = realloc(p->slot, cap * sizeof(*tab));
+		if (tab == NULL)
+			return;
+		memset(&tab[p->slotcap], 0, (cap - p->slotcap) * sizeof(*tab));
+		p->slot = tab;
+		p->slotcap = cap;
+	}
 
+	if (p->slot[slot] != NULL) {
+		return;
+	}
 
-		if (0 == strcmp(type, "abs_bits")) {
+	s = fakeston_map_get(&p->s, (uintptr_t) seatid);
+	if (s == NULL) {
+		s = calloc(1, sizeof(*s));
+		if (s == NULL)
+			return;
 
-			try_replace_n(&d[doff].ioctl_EVIOCGBIT_EV_ABS_REAL, baf, siz);
-			d[doff].realabsbits = siz;
+		s->id = (uintptr_t) seatid;
+		s->whatever.compositor = &p->comp;
+		s->whatever.keyboard = (void *) &p->k;
 
+		if (fakeston_map_put(&p->s, s->id, s) < 0) {
+			free(s);
+			return;
 		}
-
-
-	} else if (0 == strcmp(tag, "Erecd:")) {
-		void *id;
-		char fname[128] = {0};
-		int orig_rand = -1;
-		FILE *fil = NULL;
-		fscanf(tcase, "%p %127s", &id, fname);
-		sscanf(fname, "evemucase%i.txt", &orig_rand);
-
-		doff = hash_seek((void *)d, p->dhtsz, ditem_s,  id, id);
-		if (doff == p->dhtsz) {
-
+		if (fakeston_map_put(&p->z, (uintptr_t) &s->whatever, s) < 0) {
+			fakeston_map_del(&p->s, s->id);
+			free(s);
 			return;
 		}
+	}
 
-		fil = fopen(fname, "r");
-
-		if (fil == NULL) {
-			char bfname[1024] = {0};
+	d = calloc(1, sizeof(*d));
+	if (d == NULL)
+		return;
 
-			strcat(bfname, (p->subfolder));
-			strcat(bfname, "/");
-			strcat(bfname, fname);
+	d->id = (uintptr_t) id;
+	d->seatid = (uintptr_t) seatid;
+	d->init_serial = p->seq;
+	d->device = NULL;
+	d->p = p;
+	if (fakeston_fd_open(d) < 0) {
+		fakeston_sink_log(p->sink, "error: no fd for device %p\n", id);
+		free(d);
+		return;
+	}
 
-			fil = fopen(bfname, "r");
+	d->created = 0;
 
-			if (fil == NULL) {
-				fprintf(stderr, "cannot find . %s . \n", bfname);
-				return;
-			}
-		}
+	p->slot[slot] = d;
+	p->seq++;
+}
 
-		d[doff].emu_file_id = orig_rand;
+static void fakeston_evdev_dev_free(void *val, void *data)
+{
+	struct fakeston_evdev_dev *d = val;
 
-		d[doff].evt = fil;
-	} else if (0 == strcmp(tag, "Edesc:")) {
-		void *id;
-		char fname[128] = {0};
-		int orig_fd = -1;
-		FILE *fil = NULL;
-		fscanf(tcase, "%p %s", &id, fname);
-		sscanf(fname, "evemudesc%i.txt", &orig_fd);
+	fakeston_fd_close(d);
+	fakeston_desc_put(d->desc);
+	free(d);
+}
 
-		doff = hash_seek((void *)d, p->dhtsz, ditem_s,  id, id);
-		if (doff == p->dhtsz)
-			return;
+static void fakeston_seat_free(void *val, void *data)
+{
+	free(val);
+}
 
-		fil = fopen(fname, "r");
+static void fakeston_op_destroy(struct pload *p, uint32_t slot)
+{
+	struct fakeston_evdev_dev *d = p->slot[slot];
 
-		if (fil == NULL) {
-			char bfname[1024] = {0};
+	p->slot[slot] = NULL;
 
-			strcat(bfname, (p->subfolder));
-			strcat(bfname, "/");
-			strcat(bfname, fname);
+	if (d->created) {
+		fixed_p = p;
+		evdev_device_destroy(d->device);
+		fixed_p = NULL;
+		d->created = 0;
+	}
 
-			fil = fopen(bfname, "r");
+	fakeston_evdev_dev_free(d, NULL);
+}
 
-			if (fil == NULL) {
-				fprintf(stderr, "cannot find . %s . \n", bfname);
-				return;
-			}
-		}
+static void fakeston_op_ioctldump(struct fakeston_evdev_dev *d, int type,
+				  const char *baf, size_t siz)
+{
+	if ((type < 0) || (type >= FAKESTON_DUMP_CNT))
+		return;
 
-		fakeston_evdev_dev_load_desc(&d[doff], fil);
+	/* evdev never asks for more than FAKESTON_DUMP_MAX */
+	if (siz > FAKESTON_DUMP_MAX)
+		siz = FAKESTON_DUMP_MAX;
 
-		fclose(fil);
+	memcpy(d->dump[type], baf, siz);
+	d->dump_len[type] = siz;
+	d->dumped |= 1u << type;
+}
 
-		d[doff].emu_desc_id = orig_fd;
+static uint64_t fakeston_ts_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
 
+/* sleeps until the burst captured at sec.usec is due, fills in when that is */
+static void fakeston_pace_wait(struct fakeston_pace *pace, uint64_t sec,
+			       uint32_t usec, struct timespec *due)
+{
+	struct timespec now;
+	uint64_t t = sec * 1000000 + usec;
+	uint64_t off, ns;
+
+	if (!pace->started) {
+		pace->started = 1;
+		pace->t0 = t;
+		clock_gettime(CLOCK_MONOTONIC, &pace->w0);
+	}
 
-	} else if (0 == strcmp(tag, "EnewBURST:")) {
-		size_t i;
-		void *id;
-		unsigned long a, b, c, n;
-		fscanf(tcase, "%lu %lu.%lu %p %lu", &a, &b, &c, &id, &n);
+	/* a burst stamped before the first one is due at once */
+	off = (t > pace->t0) ? t - pace->t0 : 0;
+	ns = fakeston_ts_ns(&pace->w0) + (uint64_t) (off * 1000.0 / pace->speed);
+	due->tv_sec = ns / 1000000000ULL;
+	due->tv_nsec = ns % 1000000000ULL;
 
-		doff = hash_seek((void*)d, p->dhtsz, ditem_s,  id, id);
-		if (doff == p->dhtsz)
-			return;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, due, NULL) == EINTR)
+		;
 
-		if (d[doff].evt == NULL) {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = fakeston_ts_ns(&now) - fakeston_ts_ns(due);
+	pace->late_sum += ns;
+	if (ns > pace->late_max)
+		pace->late_max = ns;
+}
 
-			return;
-		}
+static void fakeston_pace_done(struct fakeston_pace *pace,
+			       const struct timespec *due)
+{
+	struct timespec now;
+	uint64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = fakeston_ts_ns(&now) - fakeston_ts_ns(due);
+	pace->lat_sum += ns;
+	if (ns > pace->lat_max)
+		pace->lat_max = ns;
+	pace->bursts++;
+}
 
-		if (n > 33) {
-			fprintf(stdout, "error: too big burst\n");
-			return;
-		}
+static void fakeston_pace_report(struct pload *p)
+{
+	struct fakeston_pace *pace = &p->pace;
+	uint64_t n = pace->bursts ? pace->bursts : 1;
+
+	fakeston_sink_log(p->sink, "FAKESTON: PACE speed %g, %llu bursts, "
+		"late avg %llu max %llu us, latency avg %llu max %llu us\n",
+		pace->speed, (unsigned long long) pace->bursts,
+		(unsigned long long) (pace->late_sum / n / 1000),
+		(unsigned long long) (pace->late_max / 1000),
+		(unsigned long long) (pace->lat_sum / n / 1000),
+		(unsigned long long) (pace->lat_max / 1000));
+}
 
-		struct input_event e[33];
+/* runs the timers that came due before a burst captured at sec.usec */
+static void fakeston_op_clock(struct pload *p, uint64_t sec, uint32_t usec)
+{
+	fixed_p = p;
+	fakeston_loop_advance(&p->display.loop, sec * 1000 + usec / 1000);
+	fixed_p = NULL;
+}
 
-		for (i = 0; i < n; i++) {
-			evemu_read_event(d[doff].evt, &e[i]);
-		}
+static void fakeston_op_burst(struct pload *p, struct fakeston_evdev_dev *d,
+			      const struct input_event *e, size_t n,
+			      uint64_t seq)
+{
+	if (p->sink->interface->burst)
+		p->sink->interface->burst(p->sink, seq, d->id);
 
-		write(p->pajpa[1], e, n * sizeof(e[0]));
+	if (d->device == NULL) {
+		fakeston_sink_log(p->sink, "error: device %p %u is null\n",
+			(void *) d->id, d->init_serial);
+		return;
+	}
 
-		if (d[doff].device == NULL) {
-			fprintf(stdout, "error: device %p %zu is null\n", id, doff);
-			return;
+	wl_event_loop_fd_func_t funkcia = d->func;
+
+	fixed_p = p;
+	if (fakeston_prof_cur)
+		fakeston_prof_burst_begin(fakeston_prof_cur, d->prof);
+
+	if (p->feed == FAKESTON_FEED_PIPE) {
+		size_t bytes = n * sizeof(e[0]);
+
+		/* the write end blocks, make room for the whole burst */
+		if (bytes > p->pajpa_sz) {
+			int sz = fcntl(p->pajpa[1], F_SETPIPE_SZ, bytes);
+			if (sz < 0) {
+				fakeston_sink_log(p->sink, "error: burst of %zu does not fit "
+					"the pipe\n", n);
+				if (fakeston_prof_cur)
+					fakeston_prof_burst_end(fakeston_prof_cur,
+								seq, d->id, 0);
+				fixed_p = NULL;
+				return;
+			}
+			p->pajpa_sz = sz;
 		}
 
-		struct wl_event_source_fd *fdsource = (struct wl_event_source_fd *) d[doff].device->source;
-
-		wl_event_loop_fd_func_t funkcia = fdsource->func;
-
+		fakeston_prof_enter(FAKESTON_STAGE_TRANSPORT);
+		if (write(p->pajpa[1], e, bytes) != (ssize_t) bytes)
+			fakeston_sink_log(p->sink, "error: short burst write\n");
+		fakeston_prof_leave();
+
+		fakeston_prof_enter(FAKESTON_STAGE_DISPATCH);
+		funkcia(p->pajpa[0] , 1337, d->device);
+		fakeston_prof_leave();
+	} else {
+		/* evdev reads the burst back through the read() override */
+		p->feed_fd = d->fd;
+		p->feed_ev = e;
+		p->feed_cnt = n;
+
+		fakeston_prof_enter(FAKESTON_STAGE_DISPATCH);
+		funkcia(d->fd, 1337, d->device);
+		fakeston_prof_leave();
+
+		p->feed_ev = NULL;
+		p->feed_cnt = 0;
+	}
 
+	if (fakeston_prof_cur)
+		fakeston_prof_burst_end(fakeston_prof_cur, seq, d->id, n);
+	fixed_p = NULL;
+}
 
-		fixed_p = p;
+static void fakeston_exec_rec(void *data, const struct fakeston_bin_rec *rec,
+			      const void *payload)
+{
+	struct pload *p = (struct pload *) data;
+	struct fakeston_evdev_dev *d;
+	void *id = (void *)(uintptr_t) rec->id;
 
-		funkcia(p->pajpa[0] , 1337, d[doff].device);
+	switch (rec->op) {
+	case FAKESTON_OP_SEATFOCUS:
+		fakeston_op_seatfocus(p, id);
+		return;
+	case FAKESTON_OP_PREPARE:
+		fakeston_op_prepare(p, rec->slot, id,
+				    (void *)(uintptr_t) rec->aux);
+		return;
+	}
 
-		fixed_p = NULL;
+	/* every other record names its device by slot */
+	if (rec->slot >= p->slotcap)
+		return;
+	d = p->slot[rec->slot];
+	if (d == NULL)
+		return;
 
+	switch (rec->op) {
+	case FAKESTON_OP_CREATE:
+		fakeston_op_create(p, d);
+		break;
+	case FAKESTON_OP_DESTROY:
+		fakeston_op_destroy(p, rec->slot);
+		break;
+	case FAKESTON_OP_IOCTLDUMP:
+		fakeston_op_ioctldump(d, rec->arg, payload, rec->size);
+		break;
+	case FAKESTON_OP_RECD:
+		d->emu_file_id = rec->arg;
+		break;
+	case FAKESTON_OP_DESC:
+		if (payload) {
+			const struct fakeston_desc *desc = fakeston_desc_get(payload);
+
+			fakeston_desc_put(d->desc);
+			d->desc = desc;
+		}
+		d->emu_desc_id = rec->arg;
+		break;
+	case FAKESTON_OP_BURST:
+		if (p->pace.speed > 0) {
+			struct timespec due;
+
+			fakeston_pace_wait(&p->pace, rec->sec, rec->usec, &due);
+			fakeston_op_clock(p, rec->sec, rec->usec);
+			fakeston_op_burst(p, d, payload, rec->arg, rec->aux);
+			fakeston_pace_done(&p->pace, &due);
+			break;
+		}
+		fakeston_op_clock(p, rec->sec, rec->usec);
+		fakeston_op_burst(p, d, payload, rec->arg, rec->aux);
+		break;
 	}
 }
 
+void fakeston_exec(void *data, const struct fakeston_bin_rec *rec,
+		   const void *payload)
+{
+	fakeston_prof_enter(FAKESTON_STAGE_REPLAY);
+	fakeston_exec_rec(data, rec, payload);
+	fakeston_prof_leave();
+}
+
 void fakeston_api_handler(void**dst, int call, void *data)
 {
-	struct fakeston_evdev_rev *r = (struct fakeston_evdev_rev *) fixed_p->r;
-	struct fakeston_evdev_rev *z = (struct fakeston_evdev_rev *) fixed_p->z;
-	struct fakeston_evdev_dev *d = (struct fakeston_evdev_dev *) fixed_p->d;
-	struct fakeston_evdev_seat *s = (struct fakeston_evdev_seat *) fixed_p->s;
-	size_t ritem_s = sizeof(struct fakeston_evdev_rev);
-	size_t roff, doff, zoff, soff;
+	struct pload *p;
+	struct fakeston_evdev_dev *d;
+	struct fakeston_evdev_seat *s;
 
-	if (fixed_p == NULL)
+	/* call 5 passes the seat, the others the device fd */
+	if (call == 5)
+		p = fakeston_ctx_from_seat((struct weston_seat *) data);
+	else
+		p = fakeston_ctx_from_fd((int) (intptr_t) data);
+
+	if (p == NULL)
 		return;
 
 	if (call == 5) {
-		zoff = hash_seek((void*)z, fixed_p->shtsz, ritem_s, data, data);
-		if (zoff == fixed_p->shtsz) {
+		s = fakeston_map_get(&p->z, (uintptr_t) data);
+		if (s == NULL) {
 			return;
 		}
-		soff = z[zoff].off;
-		*dst = (void*) s[soff].id;
+		*dst = (void*) s->id;
 
 	}
 
-	roff = hash_seek((void*)r, fixed_p->dhtsz, ritem_s, data, data);
-	if (roff == fixed_p->dhtsz)
-		return;
-	doff = r[roff].off;
-
-	if (d[doff].id == 0)
+	d = fakeston_ctx_dev(p, (int) (intptr_t) data);
+	if (d == NULL)
 		return;
 
 	if (call == 3)
-		*dst = (void*) (intptr_t) d[doff].emu_file_id;
+		*dst = (void*) (intptr_t) d->emu_file_id;
 	if (call == 2)
-		*dst = (void*) d[doff].id;
+		*dst = (void*) d->id;
 	if (call == 1)
-		*dst = (void*)(intptr_t)  d[doff].emu_desc_id;
+		*dst = (void*)(intptr_t)  d->emu_desc_id;
 	if (call == 4) {
-		*dst = (void*) d[doff].seatid;
+		*dst = (void*) d->seatid;
 
 	}
 }
 
+int fakeston_replay_bin(struct pload *p, const char *map, size_t len)
+{
+	const struct fakeston_bin_header *hdr = (const void *) map;
+	size_t off = FAKESTON_BIN_ALIGN(sizeof(*hdr));
+
+	if ((len < sizeof(*hdr)) ||
+	    (0 != memcmp(hdr->magic, FAKESTON_BIN_MAGIC, sizeof(hdr->magic))))
+		return -2;
+
+	if ((hdr->format != FAKESTON_BIN_FORMAT) ||
+	    (hdr->rec_size != sizeof(struct fakeston_bin_rec)) ||
+	    (hdr->event_size != sizeof(struct input_event)) ||
+	    (hdr->desc_size != sizeof(struct evemu_device)))
+		return -3;
+
+	while ((off + sizeof(struct fakeston_bin_rec) <= len) && !p->stop) {
+		const struct fakeston_bin_rec *rec = (const void *) (map + off);
+		const char *payload = map + off + sizeof(*rec);
+
+		off += sizeof(*rec) + FAKESTON_BIN_ALIGN(rec->size);
+		if (off > len)
+			return -5;
+
+		if ((rec->op == FAKESTON_OP_DESC) && rec->size &&
+		    (rec->size != sizeof(struct evemu_device)))
+			return -5;
+		if ((rec->op == FAKESTON_OP_BURST) &&
+		    (rec->size != rec->arg * sizeof(struct input_event)))
+			return -5;
+
+		fakeston_exec(p, rec, rec->size ? payload : NULL);
+	}
+
+	return 0;
+}
+
 void fakeston_parse(FILE *tcase, fakestonph_f dispatch, void*data)
 {
 	char buf[13] = {0};
 
 	while (1 == fscanf(tcase, "%12s", buf)) {
 
-		dispatch(data, buf, tcase);
+		if (dispatch(data, buf, tcase))
+			break;
 
 		while ('\n' != fgetc(tcase));
 	}
@@ -599,277 +962,519 @@ void sf(char *s)
 		*l = 0;
 }
 
+int fakeston_decoder_init(struct fakeston_decoder *dec, const char *filename,
+			  fakeston_emit_f emit, void *data)
+{
+	if (fakeston_map_init(&dec->t, 16) < 0)
+		return -1;
+	dec->freeslot = NULL;
+	dec->nslot = 0;
+	dec->nfree = dec->freecap = 0;
+	dec->subfolder = strdup(filename);
+	sf(dec->subfolder);
+	dec->emit = emit;
+	dec->data = data;
+	dec->stop = NULL;
+	return 0;
+}
 
-void foobar(){}
+void fakeston_decoder_release(struct fakeston_decoder *dec)
+{
+	fakeston_map_for_each(&dec->t, fakeston_decoder_src_free, NULL);
+	fakeston_map_release(&dec->t);
+	free(dec->freeslot);
+	free(dec->subfolder);
+}
 
-typedef int (*type_ioctl)(int __fd, unsigned long int __request, ...);
+/* opens a text test case, positioned after the format line */
+FILE *fakeston_open_case(const char *filename)
+{
+	FILE *tcase;
+	tcase = fopen(filename, "r");
 
-int ioctl (int __fd, unsigned long int __request, ...) {
-	static type_ioctl original_ioctl = NULL;
-	if(original_ioctl == NULL) {
-		void* libc = dlopen("libc.so.6", RTLD_LAZY);
-		original_ioctl = (type_ioctl)dlsym(libc, "ioctl");
-		dlclose(libc);
+	if (tcase == NULL) {
+		fprintf(stderr, "Error: cannot open ftf file '%s'\n", filename);
+		return NULL;
 	}
-	va_list argp;
-	va_start(argp, __request);
-	char* dst = va_arg(argp, void*);
 
-	if ((fixed_p != NULL) && (__fd > 1337)) {
-		struct fakeston_evdev_rev *r = (struct fakeston_evdev_rev *) fixed_p->r;
-		struct fakeston_evdev_dev *d = (struct fakeston_evdev_dev *) fixed_p->d;
-		size_t ritem_s = sizeof(struct fakeston_evdev_rev);
-		void *seek = (void *)(intptr_t)__fd;
-		
-		size_t roff = hash_seek((void*)r, fixed_p->dhtsz, ritem_s, seek, seek);
-		if (roff != fixed_p->dhtsz) {
+	char form[128];
+	unsigned int format;
 
-		size_t off = r[roff].off;
+	fscanf(tcase, "%127s %u\n", form, &format);
 
-		if (__request == 2148025632) {
+	if (0 != strcmp("FAKESTONTESTCASEFORMAT", form)) {
+		fprintf(stderr, "Error: bad format tft file '%s'\n", filename);
+		fclose(tcase);
+		return NULL;
+	}
 
-			char **source = &(d[off].ioctl_EVIOCGBIT_EV_BITS[0]);
+	if (2 != format) {
+		fprintf(stderr, "Error: unsupported format tft file '%s'\n", filename);
+		fclose(tcase);
+		return NULL;
+	}
 
-			if (source) {
+	return tcase;
+}
 
-				memcpy(dst, *source, d[off].bitsbytes[0]);
-				return d[off].bitsbytes[0];
-			}
-		} else
 
-		if ((__request == 2164278534) || (__request == 18446744071567328518ULL)) {
+typedef int (*type_ioctl)(int __fd, unsigned long int __request, ...);
+typedef ssize_t (*type_read)(int __fd, void *__buf, size_t __nbytes);
+typedef int (*type_close)(int __fd);
 
-			if (d[off].ioctl_EVIOCGNAME) {
-				void *src = d[off].ioctl_EVIOCGNAME;
-				size_t len = strlen(src);
-				strncpy(dst, src, len);
-				dst[len] = 0;
-				return 0;
+static type_ioctl original_ioctl = NULL;
+static type_read original_read = NULL;
+static type_close original_close = NULL;
+static pthread_once_t original_once = PTHREAD_ONCE_INIT;
 
-			}
+/* resolved once, the batch runner calls into us from many threads */
+static void fakeston_resolve(void)
+{
+	original_ioctl = (type_ioctl) dlsym(RTLD_NEXT, "ioctl");
+	original_read = (type_read) dlsym(RTLD_NEXT, "read");
+	original_close = (type_close) dlsym(RTLD_NEXT, "close");
+}
 
-		} else if ((__request ==  18446744071562609922ULL) || (__request ==  2148025602)) {
-			if (d[off].ioctl_EVIOCGID) {
-				size_t s = sizeof(struct input_id);
-				char *rid = d[off].ioctl_EVIOCGID;
+/*
+ * Emulated evdev ioctls. A handler answers from the captured ioctl dumps
+ * first and falls back to the evemu description; it copies at most the
+ * _IOC_SIZE the caller asked for and returns -1 when there is no data.
+ */
+typedef int (*fakeston_ioctl_f)(struct fakeston_evdev_dev *d,
+				unsigned int nr, size_t size, void *dst);
 
-				memcpy(dst, rid, s);
+static size_t fakeston_ioctl_copy(void *dst, size_t size,
+				  const char *src, size_t len)
+{
+	if (len > size)
+		len = size;
+	memcpy(dst, src, len);
+	return len;
+}
 
-				return 0;
-			}
+static int fakeston_ioctl_gid(struct fakeston_evdev_dev *d, unsigned int nr,
+			      size_t size, void *dst)
+{
+	if (d->desc == NULL)
+		return -1;
 
+	fakeston_ioctl_copy(dst, size, (const char *) &d->desc->dev.id,
+			    sizeof(struct input_id));
+	return 0;
+}
 
-		} else if ((__request == 18446744071595640073ULL) || (__request == 2163754249)) {
+static int fakeston_ioctl_gname(struct fakeston_evdev_dev *d, unsigned int nr,
+				size_t size, void *dst)
+{
+	size_t len;
 
-			if (d[off].ioctl_EVIOCGPROP) {
+	if ((d->desc == NULL) || (size == 0))
+		return -1;
 
-				memcpy(dst, d[off].ioctl_EVIOCGPROP, d[off].pbytes);
+	len = fakeston_ioctl_copy(dst, size - 1, d->desc->dev.name,
+				  strlen(d->desc->dev.name));
+	((char *) dst)[len] = 0;
+	return 0;
+}
 
-				return d[off].pbytes;
-			}
+static int fakeston_ioctl_gprop(struct fakeston_evdev_dev *d, unsigned int nr,
+				size_t size, void *dst)
+{
+	if (d->desc == NULL)
+		return -1;
+
+	return fakeston_ioctl_copy(dst, size, (const char *) d->desc->dev.prop,
+				   d->desc->dev.pbytes);
+}
+
+static int fakeston_ioctl_dump(struct fakeston_evdev_dev *d,
+			       enum fakeston_dump type, size_t size, void *dst)
+{
+	if (!(d->dumped & (1u << type)))
+		return -1;
+
+	return fakeston_ioctl_copy(dst, size, (const char *) d->dump[type],
+				   d->dump_len[type]);
+}
 
-		} else if ((__request >= 18446744071595640096ULL) && (__request < 18446744071595640128ULL)) {
+static int fakeston_ioctl_gkey(struct fakeston_evdev_dev *d, unsigned int nr,
+			       size_t size, void *dst)
+{
+	return fakeston_ioctl_dump(d, FAKESTON_DUMP_EVDEV_KEYS, size, dst);
+}
 
-			unsigned int slot = __request & 31;
+static int fakeston_ioctl_gbit(struct fakeston_evdev_dev *d, unsigned int nr,
+			       size_t size, void *dst)
+{
+	unsigned int ev = nr - _IOC_NR(EVIOCGBIT(0, 0));
+	int type = -1;
+
+	switch (ev) {
+	case EV_KEY:
+		type = FAKESTON_DUMP_KEY_BITS;
+		break;
+	case EV_REL:
+		type = FAKESTON_DUMP_REL_BITS;
+		break;
+	case EV_ABS:
+		type = FAKESTON_DUMP_ABS_BITS;
+		break;
+	}
 
-			char **source = &(d[off].ioctl_EVIOCGBIT_EV_BITS[slot]);
+	if ((type >= 0) && (d->dumped & (1u << type)))
+		return fakeston_ioctl_dump(d, type, size, dst);
 
-			if (source) {
-				
-				memcpy(dst, *source, d[off].bitsbytes[slot]);
+	if ((d->desc == NULL) || (d->desc->dev.mbytes[ev] == 0))
+		return -1;
 
-				return d[off].bitsbytes[slot];
-			}
+	return fakeston_ioctl_copy(dst, size,
+				   (const char *) d->desc->dev.mask[ev],
+				   d->desc->dev.mbytes[ev]);
+}
 
+static int fakeston_ioctl_gabs(struct fakeston_evdev_dev *d, unsigned int nr,
+			       size_t size, void *dst)
+{
+	unsigned int abs = nr - _IOC_NR(EVIOCGABS(0));
+	int type = -1;
+
+	switch (abs) {
+	case ABS_X:
+		type = FAKESTON_DUMP_ABS_X;
+		break;
+	case ABS_Y:
+		type = FAKESTON_DUMP_ABS_Y;
+		break;
+	case ABS_MT_POSITION_X:
+		type = FAKESTON_DUMP_MT_POS_X;
+		break;
+	case ABS_MT_POSITION_Y:
+		type = FAKESTON_DUMP_MT_POS_Y;
+		break;
+	case ABS_PRESSURE:
+		type = FAKESTON_DUMP_ABS_PRESSURE;
+		break;
+	}
 
-		} else if ((__request >= 0xFFFFFFFF80184540ULL) && (__request <= 0xFFFFFFFF80184579ULL)) {
+	if ((type >= 0) && (d->dumped & (1u << type)))
+		return fakeston_ioctl_dump(d, type, size, dst);
 
-			unsigned int slot = __request & 63;
+	if ((d->desc == NULL) || !(d->desc->is_abs & ((uint64_t) 1 << abs)))
+		return -1;
 
-			char **source = &(d[off].ioctl_EVIOCGBIT_EV_ABS[slot]);
+	return fakeston_ioctl_copy(dst, size,
+				   (const char *) &d->desc->dev.abs[abs],
+				   sizeof(struct input_absinfo));
+}
 
-			if ((d[off].is_abs & (1 << slot)) && (source)) {
+/* indexed by _IOC_NR of the 'E' read requests */
+static const fakeston_ioctl_f fakeston_ioctl_table[256] = {
+	[0x02] = fakeston_ioctl_gid,		/* EVIOCGID */
+	[0x06] = fakeston_ioctl_gname,		/* EVIOCGNAME */
+	[0x09] = fakeston_ioctl_gprop,		/* EVIOCGPROP */
+	[0x18] = fakeston_ioctl_gkey,		/* EVIOCGKEY */
+	[0x20 ... 0x3f] = fakeston_ioctl_gbit,	/* EVIOCGBIT */
+	[0x40 ... 0x7f] = fakeston_ioctl_gabs,	/* EVIOCGABS */
+};
 
-				memcpy(dst, *source, sizeof(struct input_absinfo));
+int ioctl (int __fd, unsigned long int __request, ...) {
+	pthread_once(&original_once, fakeston_resolve);
+	va_list argp;
+	va_start(argp, __request);
+	void *dst = va_arg(argp, void *);
+	va_end(argp);
 
-				return sizeof(struct input_absinfo);
-			}
+	struct fakeston_evdev_dev *d = fakeston_fd_dev(__fd);
 
-		} else if (__request == 2149074240) {
-			char *source = d[off].ioctl_eviocgabs_abs_x;
-			if (source) {
+	if (d == NULL)
+		return original_ioctl(__fd, __request, dst);
 
-				memcpy(dst, source, d[off].size_abs_x);
-				return d[off].size_abs_x;
-			}
-		} else if (__request == 2149074241) {
-			char *source = d[off].ioctl_eviocgabs_abs_y;
-			if (source) {
-				memcpy(dst, source, d[off].size_abs_y);
-				return d[off].size_abs_y;
-			}
-		} else if (__request == 2149074293) {
-			char *source = d[off].ioctl_eviocgabs_abs_mt_pos_x;
-			if (source) {
-				memcpy(dst, source, d[off].size_abs_mt_pos_x);
-				return d[off].size_abs_mt_pos_x;
-			}
-		} else if (__request == 2149074294) {
-			char *source = d[off].ioctl_eviocgabs_abs_mt_pos_y;
-			if (source) {
-				memcpy(dst, source, d[off].size_abs_mt_pos_y);
-				return d[off].size_abs_mt_pos_y;
-			}
-		} else if (__request == 2149074264) {
-			char *source = d[off].ioctl_EVIOCGABS_ABS_PRESSURE;
-			if (source) {
+	struct pload *fp = d->p;
+	/* callers passing an int request get it sign extended */
+	unsigned int req = (unsigned int) __request;
+	fakeston_ioctl_f func = NULL;
+	int ret;
 
-				memcpy(dst, source, d[off].evabspressure);
-				return d[off].evabspressure;
-			}
-		} else if (__request == 2148025635) {
-			char *source = d[off].ioctl_EVIOCGBIT_EV_ABS_REAL;
+	if ((_IOC_TYPE(req) == 'E') && (_IOC_DIR(req) == _IOC_READ))
+		func = fakeston_ioctl_table[_IOC_NR(req)];
 
-			if (source) {
-				memcpy(dst, source, d[off].realabsbits);
-				return d[off].realabsbits;
-			}
+	if (func == NULL) {
+		if (!fp->ioctl_warned)
+			fprintf(stderr, "Fakeston: Warning: unknown ioctl "
+				"req:%#x fd:%i.\n", req, __fd);
+		fp->ioctl_warned = 1;
+		errno = ENOTTY;
+		return -1;
+	}
 
-		} else if (__request == 2148025634) {
-			char **source = &(d[off].ioctl_EVIOCGBIT_EV_REL);
+	ret = func(d, _IOC_NR(req), _IOC_SIZE(req), dst);
+	if (ret < 0)
+		errno = EINVAL;
 
-			if (source) {
-				memcpy(dst, *source, d[off].relbits);
-				return d[off].relbits;
-			}
-		} else if ((__request == 2153792792ULL) || (__request == 2197832984ULL)) {
+	return ret;
+}
 
-			char *source = d[off].ioctl_EVIOCGKEY;
+ssize_t read(int __fd, void *__buf, size_t __nbytes)
+{
+	struct pload *p;
 
-			if (source) {
+	pthread_once(&original_once, fakeston_resolve);
 
-				memcpy(dst, source, d[off].EVIOCGKEYsize);
+	p = fakeston_ctx_from_fd(__fd);
+	if ((p != NULL) && (p->feed_ev != NULL) && (__fd == p->feed_fd)) {
+		size_t n = __nbytes / sizeof(struct input_event);
 
-				return d[off].EVIOCGKEYsize;
-			}
+		/* drained, behave like the nonblocking pipe */
+		if (p->feed_cnt == 0) {
+			errno = EAGAIN;
+			return -1;
+		}
 
-		} else if ((__request == 2153792801ULL)) {
-			char *source = d[off].ioctl_EVIOCGBIT_EV_KEY;
+		if (n > p->feed_cnt)
+			n = p->feed_cnt;
 
-			if (source) {
+		fakeston_prof_enter(FAKESTON_STAGE_TRANSPORT);
+		memcpy(__buf, p->feed_ev, n * sizeof(struct input_event));
+		p->feed_ev += n;
+		p->feed_cnt -= n;
+		fakeston_prof_leave();
 
-				memcpy(dst, source, d[off].keybytes);
+		return n * sizeof(struct input_event);
+	}
 
-				return d[off].keybytes;
-			}
+	/* the pipe of a pipe fed replay is a real fd, its pload is fixed_p */
+	if ((fixed_p != NULL) && (fixed_p->feed == FAKESTON_FEED_PIPE) &&
+	    (__fd == fixed_p->pajpa[0])) {
+		ssize_t len;
+
+		fakeston_prof_enter(FAKESTON_STAGE_TRANSPORT);
+		len = original_read(__fd, __buf, __nbytes);
+		fakeston_prof_leave();
 
-		} else
+		return len;
+	}
 
+	return original_read(__fd, __buf, __nbytes);
+}
 
+/* the placeholder fd of a device is released with the device, not by evdev */
+int close(int __fd)
+{
+	pthread_once(&original_once, fakeston_resolve);
 
-		{
-				foobar();
-			fprintf(stderr, "Fakeston: Warning: unknown ioctl req:%lu fd:%i.\n", __request, __fd);foobar();
-		}
+	if (fakeston_fd_dev(__fd) != NULL)
+		return 0;
 
+	return original_close(__fd);
+}
+
+/*
+ * Sets up an empty replay context writing to sink. On failure nothing is
+ * left to release.
+ */
+int fakeston_pload_init(struct pload *p, struct weston_output *output,
+			enum fakeston_feed feed, struct fakeston_sink *sink)
+{
+	memset(p, 0, sizeof(*p));
+	if ((fakeston_map_init(&p->s, 8) < 0) ||
+	    (fakeston_map_init(&p->z, 8) < 0)) {
+		fprintf(stderr, "Error: no memory for device tables\n");
+		fakeston_map_release(&p->s);
+		fakeston_map_release(&p->z);
+		return -4;
+	}
+	p->seq = 0;
+	p->comp.focus = 1;
+	p->output = output;
+	p->comp.config = (void *) fakeston_api_handler;
+	fakeston_loop_init(&p->display.loop);
+	p->comp.wl_display = &p->display;
+	p->comp.input_loop = &p->display.loop;
+	p->comp.idle_inhibit = 0x1337;
+	p->comp.state = 0x7331;
+	p->feed = feed;
+	p->feed_fd = -1;
+	p->feed_ev = NULL;
+	p->feed_cnt = 0;
+	p->pajpa[0] = p->pajpa[1] = -1;
+	p->sink = sink;
+
+	wl_list_init(&p->devices_list);
+
+	if (p->feed == FAKESTON_FEED_PIPE) {
+		if (pipe(p->pajpa) < 0) {
+			fprintf(stderr, "Failed pipe\n");
+			goto err_tables;
 		}
 
+		fcntl(p->pajpa[0], F_SETFD, fcntl(p->pajpa[0], F_GETFD) | FD_CLOEXEC);
+		fcntl(p->pajpa[0], F_SETFL, fcntl(p->pajpa[0], F_GETFL) | O_NONBLOCK);
+		fcntl(p->pajpa[1], F_SETFD, fcntl(p->pajpa[1], F_GETFD) | FD_CLOEXEC);
+		p->pajpa_sz = fcntl(p->pajpa[1], F_GETPIPE_SZ);
 	}
-	int ret;
-	ret = original_ioctl(__fd, __request, argp);
-	va_end(argp);
-	return ret;
-}
 
+	return 0;
+
+err_tables:
+	fakeston_loop_release(&p->display.loop);
+	fakeston_map_release(&p->s);
+	fakeston_map_release(&p->z);
+	return -4;
+}
 
-int fakeston_main(char *filename)
+/* destroys the devices and everything else but the sink */
+void fakeston_pload_release(struct pload *p)
 {
-	FILE *tcase;
-	tcase = fopen(filename, "r");
+	struct evdev_device *device, *previous = NULL;
+	size_t slot;
 
-	if (tcase == NULL) {
-		fprintf(stderr, "Error: cannot open ftf file '%s'\n", filename);
-		return -1;
+	wl_list_for_each(device, &p->devices_list, link) {
+		if (previous) {
+			fixed_p = p;
+			evdev_device_destroy(previous);
+			fixed_p = NULL;
+		}
+		previous = device;
+	}
+	if (previous) {
+		fixed_p = p;
+		evdev_device_destroy(previous);
+		fixed_p = NULL;
 	}
 
-	char form[128];
-	unsigned int format;
+	if (p->feed == FAKESTON_FEED_PIPE) {
+		close(p->pajpa[0]);
+		close(p->pajpa[1]);
+	}
 
-	fscanf(tcase, "%127s %u\n", form, &format);
+	fakeston_loop_release(&p->display.loop);
 
-	if (0 != strcmp("FAKESTONTESTCASEFORMAT", form)) {
-		fprintf(stderr, "Error: bad format tft file '%s'\n", filename);
-		return -2;
+	for (slot = 0; slot < p->slotcap; slot++)
+		if (p->slot[slot])
+			fakeston_evdev_dev_free(p->slot[slot], NULL);
+	free(p->slot);
+	fakeston_map_for_each(&p->s, fakeston_seat_free, NULL);
+	fakeston_map_release(&p->s);
+	fakeston_map_release(&p->z);
+}
+
+int fakeston_main(char *filename, const struct fakeston_config *cfg, FILE *out)
+{
+	int fd, ret = 0;
+	char magic[sizeof(((struct fakeston_bin_header *)0)->magic)] = {0};
+	struct stat st;
+	char *map = NULL;
+	FILE *tcase = NULL;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Error: cannot open ftf file '%s'\n", filename);
+		return -1;
 	}
 
-	if (2 != format) {
-		fprintf(stderr, "Error: unsupported format tft file '%s'\n", filename);
-		return -3;
+	if ((read(fd, magic, sizeof(magic)) == sizeof(magic)) &&
+	    (0 == memcmp(magic, FAKESTON_BIN_MAGIC, sizeof(magic))) &&
+	    (0 == fstat(fd, &st))) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			fprintf(stderr, "Error: cannot map ftf file '%s'\n", filename);
+			close(fd);
+			return -1;
+		}
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
 	}
+	close(fd);
 
-	const size_t shtsz = 8;/* how many seats in hashtable */
-	const size_t dhtsz = 128;/* how many devices in hashtable */
+	if (map == NULL) {
+		tcase = fakeston_open_case(filename);
+		if (tcase == NULL)
+			return -2;
+	}
 
 	struct weston_mode mode;
 	mode.width = 1024;
 	mode.height = 768;
 	struct weston_output output;
-	struct fakeston_evdev_rev reverseseats_htable[shtsz];
-	struct fakeston_evdev_seat seats_htable[shtsz];
-	struct fakeston_evdev_dev devices_htable[dhtsz];
-	struct fakeston_evdev_rev reversedev_htable[dhtsz];
+	struct fakeston_sink *sink;
 	struct pload p;
-	memset(reverseseats_htable, 0, sizeof(reverseseats_htable));
-	memset(seats_htable, 0, sizeof(seats_htable));
-	memset(devices_htable, 0, sizeof(devices_htable));
-	memset(reversedev_htable, 0, sizeof(reversedev_htable));
-	p.shtsz = shtsz;
-	p.dhtsz = dhtsz;
-	p.d = devices_htable;
-	p.s = seats_htable;
-	p.r = reversedev_htable;
-	p.z = reverseseats_htable;
-	p.seq = 0;
-	p.fd_seq = 1338;
-	p.subfolder = strdup(filename);
-	sf(p.subfolder);
-	p.comp.focus = 1;
-	p.output = &output;
+	memset(&output, 0, sizeof(output));
 	output.current = &mode;
-	p.comp.config = (void *) fakeston_api_handler;
-	p.comp.idle_inhibit = 0x1337;
-	p.comp.state = 0x7331;
-
-	wl_list_init(&p.devices_list);
 
-	if (pipe(p.pajpa) < 0) {
-		fprintf(stderr, "Failed pipe\n");
-		return -4;
+	if (cfg->expect) {
+		sink = fakeston_sink_expect_create(cfg->expect, &p.stop);
+	} else if (cfg->output == FAKESTON_OUTPUT_BINARY) {
+		fflush(out);
+		sink = fakeston_sink_binary_create(fileno(out));
+	} else {
+		sink = fakeston_sink_text_create(out);
+	}
+	if (sink == NULL) {
+		fprintf(stderr, "Error: cannot set up output\n");
+		ret = -4;
+		goto out_case;
 	}
 
-	fcntl(p.pajpa[0], F_SETFD, fcntl(p.pajpa[0], F_GETFD) | FD_CLOEXEC);
-	fcntl(p.pajpa[0], F_SETFL, fcntl(p.pajpa[0], F_GETFL) | O_NONBLOCK);
-	fcntl(p.pajpa[1], F_SETFD, fcntl(p.pajpa[1], F_GETFD) | FD_CLOEXEC);
+	ret = fakeston_pload_init(&p, &output, cfg->feed, sink);
+	if (ret < 0) {
+		sink->interface->destroy(sink);
+		goto out_case;
+	}
+	p.pace.speed = cfg->speed;
 
-	fakeston_parse(tcase, fakeston_line_handler, (void*)&p);
+	/* time not spent in any other stage is the replay's */
+	if (cfg->profile) {
+		fakeston_prof_cur = fakeston_prof_new(filename);
+		fakeston_prof_enter(FAKESTON_STAGE_REPLAY);
+	}
 
-	fclose(tcase);
+	if (tcase) {
+		struct fakeston_decoder dec;
 
-	struct evdev_device *device, *previous = NULL;
-	wl_list_for_each(device, &p.devices_list, link) {
-		if (previous) {
-			fixed_p = &p;
-			evdev_device_destroy(previous);
-			fixed_p = NULL;
+		if (fakeston_decoder_init(&dec, filename, fakeston_exec, &p) == 0) {
+			dec.stop = &p.stop;
+			fakeston_prof_enter(FAKESTON_STAGE_PARSE);
+			fakeston_parse(tcase, fakeston_line_handler, (void*)&dec);
+			fakeston_prof_leave();
+			fakeston_decoder_release(&dec);
 		}
-		previous = device;
+
+		fclose(tcase);
+	} else {
+		ret = fakeston_replay_bin(&p, map, st.st_size);
+		if (ret < 0)
+			fprintf(stderr, "Error: bad compiled ftf file '%s'\n", filename);
+
+		munmap(map, st.st_size);
 	}
-	if (previous) {
+
+	if (p.pace.speed > 0)
+		fakeston_pace_report(&p);
+
+	/* let the timers armed by the last bursts run out */
+	if (!p.stop) {
 		fixed_p = &p;
-		evdev_device_destroy(previous);
+		fakeston_loop_advance(&p.display.loop,
+				      p.display.loop.now + FAKESTON_LOOP_DRAIN_MS);
 		fixed_p = NULL;
 	}
 
-	free(p.subfolder);
-	return 0;
+	fakeston_pload_release(&p);
+
+	if ((sink->interface->finish(sink) < 0) && (ret == 0))
+		ret = -6;
+	sink->interface->destroy(sink);
+
+	if (fakeston_prof_cur) {
+		fakeston_prof_done(fakeston_prof_cur);
+		fakeston_prof_cur = NULL;
+	}
+
+	return ret;
+
+out_case:
+	if (tcase)
+		fclose(tcase);
+	else
+		munmap(map, st.st_size);
+	return ret;
 }
@@ -20,9 +20,16 @@
 
 #include <stdarg.h>
 #include <stdint.h>
+#include <time.h>
+#include <linux/input.h>
 
 #include "wayland-server-protocol.h"
 #include "compositor.h"
+#include "evemu.h"
+#include "evemu-impl.h"
+#include "fakeston_prof.h"
+
+struct epoll_event;
 
 /*copied from event-loop.c */
 struct wl_event_source {
@@ -33,69 +40,231 @@ struct wl_event_source {
 	int fd;
 };
 
+struct wl_event_source_interface {
+	int (*dispatch)(struct wl_event_source *source,
+			struct epoll_event *ep);
+};
+
 struct wl_event_source_fd {
 	struct wl_event_source base;
 	wl_event_loop_fd_func_t func;
 	int fd;
 };
+
+struct wl_event_source_timer {
+	struct wl_event_source base;
+	wl_event_loop_timer_func_t func;
+};
 /*end of copied*/
 
+/*
+ * Timers run on a virtual clock instead of timerfds. The clock follows the
+ * burst timestamps of the test case, armed timers wait in a min-heap and
+ * fire between bursts at their deadline.
+ */
+struct fakeston_timer {
+	struct wl_event_source_timer base;
+	uint64_t deadline;	/* virtual ms */
+	uint64_t serial;	/* arming order, breaks deadline ties */
+	size_t heap;		/* index in loop heap, FAKESTON_TIMER_IDLE if disarmed */
+};
+
+#define FAKESTON_TIMER_IDLE ((size_t) -1)
+
+/* how far past the last burst pending timers are still fired */
+#define FAKESTON_LOOP_DRAIN_MS 10000
+
+struct wl_event_loop {
+	struct fakeston_timer **heap;
+	size_t cnt, cap;
+	uint64_t now;		/* virtual ms */
+	uint64_t serial;
+};
+
+struct wl_display {
+	struct wl_event_loop loop;
+};
+
+/*
+ * uintptr_t key -> pointer map. Keys 0 and ~0 are reserved, the values
+ * are owned by the caller.
+ */
+struct fakeston_map_entry {
+	uintptr_t key;
+	void *val;
+};
+
+struct fakeston_map {
+	struct fakeston_map_entry *e;
+	size_t cap;	/* power of two */
+	size_t cnt;	/* live entries */
+	size_t used;	/* live entries and tombstones */
+};
+
 struct fakeston_evdev_seat {
 	uintptr_t id;
 	struct weston_seat whatever;
 };
 
-struct fakeston_evdev_rev {
-	uintptr_t id;
-	size_t off;
+/* decoded evemudesc, immutable and shared through the descriptor cache */
+struct fakeston_desc {
+	struct evemu_device dev;
+	uint64_t is_abs;	/* ABS codes with an absinfo in dev.abs */
+	uintptr_t key;		/* content hash of dev */
+	uintptr_t text_key;	/* content hash of text */
+	char *text;		/* evemudesc file it was parsed from, or NULL */
+	size_t text_len;
+	int ref;
+	int cached;
+};
+
+enum fakeston_dump {
+	FAKESTON_DUMP_KEY_BITS,
+	FAKESTON_DUMP_EVDEV_KEYS,
+	FAKESTON_DUMP_REL_BITS,
+	FAKESTON_DUMP_ABS_X,
+	FAKESTON_DUMP_ABS_Y,
+	FAKESTON_DUMP_MT_POS_X,
+	FAKESTON_DUMP_MT_POS_Y,
+	FAKESTON_DUMP_ABS_PRESSURE,
+	FAKESTON_DUMP_ABS_BITS,
+	FAKESTON_DUMP_CNT
 };
 
+/* largest ioctl answer kept, the KEY_CNT bits of EVIOCGBIT(EV_KEY) */
+#define FAKESTON_DUMP_MAX EVPLAY_NBYTES
+
+/* one allocation per device, the captured ioctl dumps are kept inline */
 struct fakeston_evdev_dev {
 	uintptr_t id;
 	uintptr_t seatid;
 	unsigned int init_serial;
 	struct evdev_device *device;
-	FILE * evt;
-	char *ioctl_eviocgabs_abs_x;
-	char *ioctl_eviocgabs_abs_y;
-	char *ioctl_eviocgabs_abs_mt_pos_x;
-	char *ioctl_eviocgabs_abs_mt_pos_y;
-	char *ioctl_EVIOCGNAME;
-	char *ioctl_EVIOCGID;
-	char *ioctl_EVIOCGPROP;
-	char *ioctl_EVIOCGKEY;
-	char *(ioctl_EVIOCGBIT_EV_BITS[32]);
-	char *ioctl_EVIOCGBIT_EV_KEY;
-	char *ioctl_EVIOCGBIT_EV_REL;
-	char *(ioctl_EVIOCGBIT_EV_ABS[64]);
-	char *ioctl_EVIOCGBIT_EV_ABS_REAL;
-	char *ioctl_EVIOCGABS_ABS_PRESSURE;
-	size_t pbytes;
-	size_t bitsbytes[32];
-	unsigned int is_abs;
-	size_t 	EVIOCGKEYsize;
-	size_t realabsbits;
-	size_t keybytes;
-	size_t absbits, relbits;
-	size_t size_abs_x, size_abs_y, size_abs_mt_pos_x, size_abs_mt_pos_y;
-	size_t evabspressure;
+	wl_event_loop_fd_func_t func;	/* fd callback of device, for bursts */
+	const struct fakeston_desc *desc;	/* evemu description, shared */
+	struct fakeston_prof_dev *prof;	/* stage times, when profiling */
+	uint32_t dumped;	/* 1 << fakeston_dump of every dump captured */
+	uint16_t dump_len[FAKESTON_DUMP_CNT];
+	unsigned char dump[FAKESTON_DUMP_CNT][FAKESTON_DUMP_MAX];
 	int created;
-	int fd;
+	int fd;			/* placeholder fd on /dev/null */
+	struct pload *p;	/* replay of the device */
 	int emu_file_id;
 	int emu_desc_id;
 };
 
+enum fakeston_feed {
+	FAKESTON_FEED_MEMORY,	/* read() on the device fd served from memory */
+	FAKESTON_FEED_PIPE	/* bursts go through a real pipe */
+};
+
+/* device slots of one replay */
+#define FAKESTON_SLOT_MAX 65536
+/* fake device fds are placeholder fds below this */
+#define FAKESTON_FD_MAX (1 << 20)
+
+enum fakeston_output {
+	FAKESTON_OUTPUT_TEXT,	/* notify_* lines */
+	FAKESTON_OUTPUT_BINARY	/* fakeston_notify_rec stream */
+};
+
+struct fakeston_config {
+	enum fakeston_feed feed;
+	enum fakeston_output output;
+	const char *expect;	/* golden binary notify stream to compare */
+	double speed;		/* 1.0 paces bursts in real time, 0 floods */
+	int profile;		/* time the stages of the replay */
+};
+
+/*
+ * Paced replay. Burst n is due at start + (ts[n] - ts[0]) / speed on the
+ * monotonic clock; sleeping to absolute deadlines keeps the error of one
+ * burst from carrying over to the next.
+ */
+struct fakeston_pace {
+	double speed;
+	int started;
+	uint64_t t0;		/* capture time of the first burst, us */
+	struct timespec w0;	/* when the first burst was replayed */
+	uint64_t bursts;
+	uint64_t late_sum, late_max;	/* wakeup past the deadline, ns */
+	uint64_t lat_sum, lat_max;	/* deadline to burst processed, ns */
+};
+
+/*
+ * Binary notify stream: a fakeston_notify_header followed by records.
+ * The seat is the captured seat id, so streams of different runs compare.
+ */
+#define FAKESTON_NOTIFY_MAGIC "FAKESTONOUT"
+#define FAKESTON_NOTIFY_FORMAT 1
+
+enum fakeston_notify_type {
+	FAKESTON_NOTIFY_BUTTON = 1,	/* button, state */
+	FAKESTON_NOTIFY_AXIS,		/* axis, value */
+	FAKESTON_NOTIFY_MODIFIERS,	/* serial */
+	FAKESTON_NOTIFY_MOTION,		/* dx, dy */
+	FAKESTON_NOTIFY_MOTION_ABSOLUTE,	/* x, y */
+	FAKESTON_NOTIFY_KEY,		/* key, state, update_state */
+	FAKESTON_NOTIFY_TOUCH,		/* touch_id, x, y, touch_type */
+	FAKESTON_NOTIFY_GESTURE		/* gesture | state << 16, dx, dy,
+					 * scale */
+};
+
+struct fakeston_notify_header {
+	char magic[12];
+	uint32_t format;
+	uint32_t rec_size;
+	uint32_t reserved;
+};
+
+struct fakeston_notify_rec {
+	uint32_t type;
+	uint32_t time;
+	uint64_t seat;
+	int32_t arg[4];
+};
+
+struct fakeston_sink;
+
+struct fakeston_sink_interface {
+	/* one notify_* call, seat is the live weston_seat */
+	void (*notify)(struct fakeston_sink *sink, void *seat,
+		       const struct fakeston_notify_rec *n);
+
+	/* weston_log() and replay messages */
+	void (*log)(struct fakeston_sink *sink, const char *fmt, va_list ap);
+
+	/* a burst of the captured device dev is about to replay, optional */
+	void (*burst)(struct fakeston_sink *sink, uint64_t seq, uint64_t dev);
+
+	/* end of the replay, returns -1 if the output failed */
+	int (*finish)(struct fakeston_sink *sink);
+
+	void (*destroy)(struct fakeston_sink *sink);
+};
+
+struct fakeston_sink {
+	const struct fakeston_sink_interface *interface;
+};
+
 struct pload {
-	struct fakeston_evdev_rev *z;
-	struct fakeston_evdev_rev *r;
-	struct fakeston_evdev_seat *s;
-	struct fakeston_evdev_dev *d;
-	size_t shtsz, dhtsz;
+	struct fakeston_map z;	/* weston_seat * -> fakeston_evdev_seat */
+	struct fakeston_map s;	/* captured seat id -> fakeston_evdev_seat */
+	struct fakeston_evdev_dev **slot;	/* by device slot */
+	size_t slotcap;
 	unsigned int seq;
-	int fd_seq;
+	int ioctl_warned;
 	int pajpa[2];
-	char *subfolder;
+	size_t pajpa_sz;
+	enum fakeston_feed feed;
+	int feed_fd;
+	const struct input_event *feed_ev;
+	size_t feed_cnt;
+	struct fakeston_sink *sink;
+	int stop;	/* raised by the sink, ends the replay */
+	struct fakeston_pace pace;
 	struct wl_list devices_list;
+	struct wl_display display;	/* comp.wl_display, owns the timers */
 	struct weston_compositor comp;
 	struct weston_output *output;
 	int /*struct wl_keyboard*/ k;
@@ -111,13 +280,143 @@ struct fakeston_evdev_elog {
 	unsigned int evlog_burstseq;
 };
 
+/*
+ * Compiled test case. The text ftestcase and the evemucase/evemudesc files
+ * it references are decoded once into a stream of fixed-size records, each
+ * followed by an 8-byte aligned payload:
+ *
+ *   FAKESTON_OP_DESC       struct evemu_device
+ *   FAKESTON_OP_IOCTLDUMP  raw ioctl bytes, arg is the fakeston_dump type
+ *   FAKESTON_OP_BURST      arg times struct input_event
+ *
+ * Devices are resolved to dense slots when they are prepared, every later
+ * record of a device carries its slot so replay never looks up the captured
+ * pointer. Slots of destroyed devices are reused.
+ *
+ * The text replay goes through the same records, so both paths execute
+ * identically. The layout is host specific, the header guards against
+ * replaying a file compiled on a different ABI.
+ */
+#define FAKESTON_BIN_MAGIC "FAKESTONBIN"
+#define FAKESTON_BIN_FORMAT 2
+
+enum fakeston_op {
+	FAKESTON_OP_PREPARE = 1,
+	FAKESTON_OP_DESC,
+	FAKESTON_OP_RECD,
+	FAKESTON_OP_IOCTLDUMP,
+	FAKESTON_OP_CREATE,
+	FAKESTON_OP_DESTROY,
+	FAKESTON_OP_SEATFOCUS,
+	FAKESTON_OP_BURST
+};
+
+struct fakeston_bin_header {
+	char magic[12];
+	uint32_t format;
+	uint32_t rec_size;
+	uint32_t event_size;
+	uint32_t desc_size;
+	uint32_t reserved;
+};
+
+struct fakeston_bin_rec {
+	uint32_t op;
+	uint32_t arg;	/* dump type, file/desc id or event count */
+	uint64_t id;	/* device, or seat for FAKESTON_OP_SEATFOCUS */
+	uint64_t aux;	/* seat for FAKESTON_OP_PREPARE, burst seq */
+	uint64_t sec;
+	uint32_t usec;
+	uint32_t size;	/* payload bytes following the record */
+	uint32_t slot;	/* device slot, FAKESTON_SLOT_NONE for seats */
+	uint32_t reserved;
+};
+
+#define FAKESTON_SLOT_NONE UINT32_MAX
+
+#define FAKESTON_BIN_ALIGN(x) (((x) + 7) & ~(size_t) 7)
+
+typedef void (*fakeston_emit_f)(void *, const struct fakeston_bin_rec *,
+				const void *);
+
+struct fakeston_evdev_src {
+	uintptr_t id;
+	uint32_t slot;
+	struct evemu_stream *evt;
+	struct input_event *ev;	/* burst buffer, grows on demand */
+	size_t evcap;
+};
+
+/* turns ftestcase lines into records */
+struct fakeston_decoder {
+	char *subfolder;
+	struct fakeston_map t;	/* captured device id -> fakeston_evdev_src */
+	uint32_t nslot;		/* slots handed out so far */
+	uint32_t *freeslot;	/* slots of destroyed devices */
+	size_t nfree, freecap;
+	fakeston_emit_f emit;
+	void *data;
+	const int *stop;	/* stop decoding once set, may be NULL */
+	char blob[1024];	/* ioctl dump payload */
+};
+
 typedef void (*fakestonapihndlr_f)(void**, int, void *);
 
-typedef void (*fakestonph_f)(void*, char*, FILE *);
+/* returns nonzero to stop parsing */
+typedef int (*fakestonph_f)(void*, char*, FILE *);
+
+extern __thread struct pload *fixed_p;
+
+int fakeston_map_init(struct fakeston_map *m, size_t cap);
+void fakeston_map_release(struct fakeston_map *m);
+void *fakeston_map_get(const struct fakeston_map *m, uintptr_t key);
+int fakeston_map_put(struct fakeston_map *m, uintptr_t key, void *val);
+void *fakeston_map_del(struct fakeston_map *m, uintptr_t key);
+void fakeston_map_for_each(struct fakeston_map *m,
+			   void (*func)(void *val, void *data), void *data);
+
+void usage();
+struct fakeston_sink *fakeston_sink_text_create(FILE *out);
+struct fakeston_sink *fakeston_sink_binary_create(int fd);
+struct fakeston_sink *fakeston_sink_expect_create(const char *golden, int *stop);
+void fakeston_sink_log(struct fakeston_sink *sink, const char *fmt, ...);
+void fakeston_notify(struct weston_seat *seat, struct fakeston_notify_rec *n);
+int fakeston_vlog(const char *fmt, va_list ap);
+
+const struct fakeston_desc *fakeston_desc_get(const struct evemu_device *dev);
+const struct fakeston_desc *fakeston_desc_load(int fd);
+void fakeston_desc_put(const struct fakeston_desc *desc);
+
+void fakeston_loop_init(struct wl_event_loop *loop);
+void fakeston_loop_release(struct wl_event_loop *loop);
+void fakeston_loop_advance(struct wl_event_loop *loop, uint64_t now);
+
+extern __thread const char *fakeston_accel_devname;
+
+int fakeston_accel_add(const char *rule);
+const struct weston_accel_profile *fakeston_accel_find(const char *devname);
+void fakeston_accel_clear(void);
 
-extern struct pload *fixed_p;
+struct pload *fakeston_ctx_from_fd(int fd);
+struct pload *fakeston_ctx_from_seat(struct weston_seat *seat);
+struct fakeston_evdev_dev *fakeston_ctx_dev(struct pload *p, int fd);
 
-void fakeston_line_handler(void*data, char*tag, FILE *tcase);
+FILE *fakeston_open_case(const char *filename);
+int fakeston_decoder_init(struct fakeston_decoder *dec, const char *filename,
+			  fakeston_emit_f emit, void *data);
+void fakeston_decoder_release(struct fakeston_decoder *dec);
+void fakeston_parse(FILE *tcase, fakestonph_f dispatch, void*data);
+int fakeston_line_handler(void*data, char*tag, FILE *tcase);
+void fakeston_exec(void *data, const struct fakeston_bin_rec *rec,
+		   const void *payload);
 void fakeston_api_handler(void**dst, int call, void *data);
+int fakeston_pload_init(struct pload *p, struct weston_output *output,
+			enum fakeston_feed feed, struct fakeston_sink *sink);
+void fakeston_pload_release(struct pload *p);
+int fakeston_replay_bin(struct pload *p, const char *map, size_t len);
+int fakeston_compile(const char *filename, const char *outname);
+int fakeston_main(char *filename, const struct fakeston_config *cfg, FILE *out);
+int fakeston_batch(char **paths, int npaths,
+		   const struct fakeston_config *cfg, int jobs);
 
 #endif
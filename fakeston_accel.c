@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fakeston.h"
+#include "filter.h"
+
+/*
+ * Profiles of the devices, by name. The rules are added before devices
+ * are created and stay until fakeston_accel_clear(). The touchpad gets
+ * its profile when it creates its filter, which build.sh links with
+ * --wrap, so that evdev-touchpad.c and filter.c stay as upstream.
+ */
+
+struct fakeston_accel_rule {
+	char *device;		/* part of the device name, NULL for any */
+	struct weston_accel_profile *profile;
+};
+
+static struct fakeston_accel_rule *fakeston_accel_rules;
+static int fakeston_accel_count;
+
+/* name of the device being created, NULL outside evdev_device_create */
+__thread const char *fakeston_accel_devname = NULL;
+
+int
+fakeston_accel_add(const char *rule)
+{
+	struct fakeston_accel_rule *rules;
+	const char *eq = strchr(rule, '=');
+	const char *colon = strchr(rule, ':');
+	char *device = NULL;
+
+	/* a '=' after the profile name is in its arguments */
+	if (eq && (!colon || (eq < colon))) {
+		device = strndup(rule, eq - rule);
+		if (device == NULL)
+			return -1;
+		rule = eq + 1;
+	}
+
+	rules = realloc(fakeston_accel_rules,
+			(fakeston_accel_count + 1) * sizeof(*rules));
+	if (rules == NULL) {
+		free(device);
+		return -1;
+	}
+	fakeston_accel_rules = rules;
+
+	rules[fakeston_accel_count].profile = weston_accel_profile_create(rule);
+	if (rules[fakeston_accel_count].profile == NULL) {
+		free(device);
+		return -1;
+	}
+	rules[fakeston_accel_count++].device = device;
+
+	return 0;
+}
+
+const struct weston_accel_profile *
+fakeston_accel_find(const char *devname)
+{
+	int i;
+
+	for (i = 0; i < fakeston_accel_count; i++)
+		if ((fakeston_accel_rules[i].device == NULL) ||
+		    (strstr(devname, fakeston_accel_rules[i].device) != NULL))
+			return fakeston_accel_rules[i].profile;
+
+	return NULL;
+}
+
+void
+fakeston_accel_clear(void)
+{
+	int i;
+
+	for (i = 0; i < fakeston_accel_count; i++) {
+		free(fakeston_accel_rules[i].device);
+		weston_accel_profile_destroy(fakeston_accel_rules[i].profile);
+	}
+	free(fakeston_accel_rules);
+	fakeston_accel_rules = NULL;
+	fakeston_accel_count = 0;
+}
+
+struct weston_motion_filter *
+__real_create_pointer_accelator_filter(accel_profile_func_t profile);
+
+struct weston_motion_filter *
+__wrap_create_pointer_accelator_filter(accel_profile_func_t profile)
+{
+	const struct weston_accel_profile *rule = NULL;
+
+	if (fakeston_accel_devname != NULL)
+		rule = fakeston_accel_find(fakeston_accel_devname);
+
+	if (rule == NULL)
+		return __real_create_pointer_accelator_filter(profile);
+
+	return weston_accel_profile_filter(rule, profile);
+}
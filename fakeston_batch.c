@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "compositor.h"
+#include "fakeston.h"
+
+/*
+ * Batch runner. Every test case is one job replayed by fakeston_main on its
+ * own pload, so each job has its own tables, pipe and output sink. The jobs
+ * are independent and similar in size, the workers simply take the next
+ * one off a shared cursor. Job output is spooled to a temporary file and
+ * printed in the order the jobs were given, so the log of a batch does not
+ * depend on scheduling. With binary output the records of all jobs make
+ * one stream, under the header of the first job.
+ */
+
+struct fakeston_job {
+	char *path;
+	FILE *out;
+	int ret;
+	int done;
+};
+
+struct fakeston_batch {
+	struct fakeston_job *job;
+	size_t cnt, cap;
+	size_t next;		/* next job to take, atomic */
+	size_t printed;		/* jobs before this one are printed */
+	int failed;
+	int headed;		/* the binary stream header is out */
+	const struct fakeston_config *cfg;
+	pthread_mutex_t lock;
+};
+
+static int
+fakeston_batch_add(struct fakeston_batch *b, const char *path)
+{
+	if (b->cnt == b->cap) {
+		size_t cap = b->cap ? b->cap * 2 : 64;
+		struct fakeston_job *job;
+
+		job = realloc(b->job, cap * sizeof(*job));
+		if (job == NULL)
+			return -1;
+		b->job = job;
+		b->cap = cap;
+	}
+
+	memset(&b->job[b->cnt], 0, sizeof(b->job[b->cnt]));
+	b->job[b->cnt].path = strdup(path);
+	if (b->job[b->cnt].path == NULL)
+		return -1;
+	b->cnt++;
+
+	return 0;
+}
+
+static int
+fakeston_batch_filter(const struct dirent *de)
+{
+	size_t len = strlen(de->d_name);
+
+	if (0 == strncmp(de->d_name, "ftestcase", 9) &&
+	    len > 4 && 0 == strcmp(de->d_name + len - 4, ".txt"))
+		return 1;
+
+	return len > 5 && 0 == strcmp(de->d_name + len - 5, ".fbin");
+}
+
+static int
+fakeston_batch_scan(struct fakeston_batch *b, const char *path)
+{
+	struct dirent **names;
+	struct stat st;
+	char *name;
+	int i, n, ret = 0;
+
+	if ((stat(path, &st) < 0) || !S_ISDIR(st.st_mode))
+		return fakeston_batch_add(b, path);
+
+	n = scandir(path, &names, fakeston_batch_filter, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "Error: cannot scan directory '%s'\n", path);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if ((ret == 0) &&
+		    (asprintf(&name, "%s/%s", path, names[i]->d_name) >= 0)) {
+			ret = fakeston_batch_add(b, name);
+			free(name);
+		} else {
+			ret = -1;
+		}
+		free(names[i]);
+	}
+	free(names);
+
+	return ret;
+}
+
+/* prints finished jobs in order, called with the lock held */
+static void
+fakeston_batch_flush(struct fakeston_batch *b)
+{
+	struct fakeston_job *job;
+	struct fakeston_notify_header hdr;
+	char buf[65536];
+	size_t n;
+	/* keep a binary record stream free of text */
+	FILE *log = (b->cfg->output == FAKESTON_OUTPUT_BINARY) ? stderr : stdout;
+
+	while ((b->printed < b->cnt) && b->job[b->printed].done) {
+		job = &b->job[b->printed++];
+
+		fprintf(log, "FAKESTON: JOB %s\n", job->path);
+		if (job->out) {
+			rewind(job->out);
+			/* one header for the whole batch */
+			if ((b->cfg->output == FAKESTON_OUTPUT_BINARY) &&
+			    (fread(&hdr, sizeof(hdr), 1, job->out) == 1) &&
+			    !b->headed) {
+				fwrite(&hdr, sizeof(hdr), 1, stdout);
+				b->headed = 1;
+			}
+			while ((n = fread(buf, 1, sizeof(buf), job->out)) > 0)
+				fwrite(buf, 1, n, stdout);
+			fclose(job->out);
+			job->out = NULL;
+		}
+		fprintf(log, "FAKESTON: JOB %s returned %i\n",
+			job->path, job->ret);
+
+		if (job->ret != 0)
+			b->failed++;
+	}
+	fflush(stdout);
+}
+
+static void *
+fakeston_batch_worker(void *data)
+{
+	struct fakeston_batch *b = data;
+	struct fakeston_job *job;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->cnt) {
+		job = &b->job[i];
+
+		job->out = tmpfile();
+		if (job->out == NULL) {
+			fprintf(stderr, "Error: cannot spool job '%s'\n",
+				job->path);
+			job->ret = -1;
+		} else {
+			job->ret = fakeston_main(job->path, b->cfg, job->out);
+		}
+
+		pthread_mutex_lock(&b->lock);
+		job->done = 1;
+		fakeston_batch_flush(b);
+		pthread_mutex_unlock(&b->lock);
+	}
+
+	return NULL;
+}
+
+int
+fakeston_batch(char **paths, int npaths, const struct fakeston_config *cfg,
+	       int jobs)
+{
+	struct fakeston_batch b;
+	pthread_t *thread;
+	size_t i;
+	int started = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.cfg = cfg;
+	pthread_mutex_init(&b.lock, NULL);
+
+	for (i = 0; i < (size_t) npaths; i++)
+		if (fakeston_batch_scan(&b, paths[i]) < 0) {
+			b.failed = 1;
+			goto out;
+		}
+
+	if (jobs < 1)
+		jobs = 1;
+	if ((size_t) jobs > b.cnt)
+		jobs = b.cnt;
+
+	thread = calloc(jobs ? jobs : 1, sizeof(*thread));
+	if (thread == NULL) {
+		b.failed = 1;
+		goto out;
+	}
+
+	for (started = 0; started < jobs; started++)
+		if (pthread_create(&thread[started], NULL,
+				   fakeston_batch_worker, &b) != 0)
+			break;
+
+	/* the pool may come up short, the caller then works too */
+	if (started < jobs)
+		fakeston_batch_worker(&b);
+
+	while (started--)
+		pthread_join(thread[started], NULL);
+	free(thread);
+
+	fprintf(b.cfg->output == FAKESTON_OUTPUT_BINARY ? stderr : stdout,
+		"FAKESTON: BATCH %zu jobs, %i failed\n",
+		b.cnt, b.failed);
+out:
+	for (i = 0; i < b.cnt; i++)
+		free(b.job[i].path);
+	free(b.job);
+	pthread_mutex_destroy(&b.lock);
+
+	return b.failed ? -1 : 0;
+}
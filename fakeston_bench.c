@@ -0,0 +1,1210 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <math.h>
+
+#include "fakeston.h"
+#include "evdev.h"
+
+/*
+ * filter.c is built into the bench instead of linked to it, so that the
+ * bench reaches its static functions and decides which of the vector
+ * kernels the CPU runs: every __builtin_cpu_supports() of filter.c asks
+ * fakeston_bench_cpu_supports(), SSE2 included.
+ */
+#define FAKESTON_BENCH_SSE2 (1 << 0)
+#define FAKESTON_BENCH_AVX2 (1 << 1)
+
+/* the features filter.c is told of, all the CPU has by default */
+static int fakeston_bench_cpu = ~0;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#undef __SSE2__
+
+static int fakeston_bench_cpu_real(void)
+{
+	return (__builtin_cpu_supports("sse2") ? FAKESTON_BENCH_SSE2 : 0) |
+	       (__builtin_cpu_supports("avx2") ? FAKESTON_BENCH_AVX2 : 0);
+}
+
+static int fakeston_bench_cpu_supports(const char *feature)
+{
+	int bit = (strcmp(feature, "avx2") == 0) ? FAKESTON_BENCH_AVX2 :
+		  (strcmp(feature, "sse2") == 0) ? FAKESTON_BENCH_SSE2 : 0;
+
+	return (fakeston_bench_cpu & fakeston_bench_cpu_real() & bit) != 0;
+}
+
+#define __builtin_cpu_supports(feature) fakeston_bench_cpu_supports(feature)
+#else
+static int fakeston_bench_cpu_real(void)
+{
+	return 0;
+}
+#endif
+
+#include "filter.c"
+
+#undef __builtin_cpu_supports
+
+/*
+ * Microbenchmarks of the evdev input path. Every stream is replayed into a
+ * fresh device of a fresh replay context, three ways:
+ *
+ *   fallback_process / touchpad_process - the dispatch interface alone,
+ *                                          event by event
+ *   +evdev_flush_motion                  - the same, flushing the motion
+ *                                          after every SYN_REPORT
+ *   process_events                       - whole bursts through the loop
+ *                                          evdev.c picked for the device
+ *   evdev_device_data                    - whole bursts through the fd
+ *                                          callback, as the replay does
+ *
+ * and accelerator_filter is timed on its own, one motion at a time,
+ * batched and with a spline profile, and its get_direction() against the
+ * atan2 one it replaced.
+ * Output goes to a sink that only counts. The best of a few runs is
+ * reported, allocations are counted by wrapping the libc allocator.
+ *
+ * With -d N the bench instead checks get_direction() against the atan2
+ * one for every dx, dy in [-N, N], with -k N the batch path of
+ * accelerator_filter with every vector kernel against the scalar one on N
+ * pseudo-random motions.
+ */
+
+#define FAKESTON_BENCH_EVENTS 200000
+#define FAKESTON_BENCH_REPEAT 5
+#define FAKESTON_BENCH_CAPTURE "emudumps/hw_test3/ftestcase1562749452.txt"
+
+extern struct evdev_dispatch_interface touchpad_interface;
+void evdev_flush_motion(struct evdev_device *device, uint32_t time);
+
+/* allocations of this thread, every malloc, calloc and realloc */
+static __thread uint64_t fakeston_bench_allocs;
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	fakeston_bench_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	fakeston_bench_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	fakeston_bench_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+enum fakeston_bench_path {
+	FAKESTON_BENCH_PROCESS,
+	FAKESTON_BENCH_FLUSH,
+	FAKESTON_BENCH_EVENTS_LOOP,
+	FAKESTON_BENCH_DISPATCH,
+	FAKESTON_BENCH_PATH_CNT
+};
+
+/* a record setting up the device, before it is created */
+struct fakeston_bench_setup {
+	struct fakeston_bin_rec rec;
+	void *payload;
+};
+
+struct fakeston_bench_stream {
+	const char *name;
+	struct fakeston_bench_setup *setup;
+	size_t nsetup;
+	struct input_event *ev;
+	size_t cnt, cap;
+	size_t *burst;		/* first event of every burst */
+	size_t nburst, burstcap;
+	int touchpad;		/* desc makes evdev.c pick the touchpad */
+};
+
+struct fakeston_bench_sink {
+	struct fakeston_sink base;
+	uint64_t notify;
+};
+
+struct fakeston_bench_result {
+	uint64_t ns, events, allocs, notify;
+};
+
+static void
+fakeston_bench_sink_notify(struct fakeston_sink *sink, void *seat,
+			   const struct fakeston_notify_rec *n)
+{
+	((struct fakeston_bench_sink *) sink)->notify++;
+}
+
+static void
+fakeston_bench_sink_log(struct fakeston_sink *sink, const char *fmt, va_list ap)
+{
+}
+
+static int fakeston_bench_sink_finish(struct fakeston_sink *sink)
+{
+	return 0;
+}
+
+static void fakeston_bench_sink_destroy(struct fakeston_sink *sink)
+{
+}
+
+static const struct fakeston_sink_interface fakeston_bench_sink_interface = {
+	fakeston_bench_sink_notify,
+	fakeston_bench_sink_log,
+	NULL,
+	fakeston_bench_sink_finish,
+	fakeston_bench_sink_destroy
+};
+
+static uint64_t fakeston_bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t fakeston_bench_seed = 1;
+
+static int32_t fakeston_bench_rand(int32_t range)
+{
+	fakeston_bench_seed = fakeston_bench_seed * 1103515245 + 12345;
+	return (int32_t) ((fakeston_bench_seed >> 16) % (2 * range + 1)) - range;
+}
+
+static int fakeston_bench_setup_add(struct fakeston_bench_stream *st,
+				    const struct fakeston_bin_rec *rec,
+				    const void *payload)
+{
+	struct fakeston_bench_setup *setup;
+
+	setup = realloc(st->setup, (st->nsetup + 1) * sizeof(*setup));
+	if (setup == NULL)
+		return -1;
+	st->setup = setup;
+	setup = &setup[st->nsetup];
+
+	setup->rec = *rec;
+	setup->payload = NULL;
+	if (rec->size) {
+		setup->payload = malloc(rec->size);
+		if (setup->payload == NULL)
+			return -1;
+		memcpy(setup->payload, payload, rec->size);
+	}
+	st->nsetup++;
+
+	return 0;
+}
+
+static int fakeston_bench_burst(struct fakeston_bench_stream *st)
+{
+	if (st->nburst == st->burstcap) {
+		size_t cap = st->burstcap ? st->burstcap * 2 : 1024;
+		size_t *burst = realloc(st->burst, cap * sizeof(*burst));
+
+		if (burst == NULL)
+			return -1;
+		st->burst = burst;
+		st->burstcap = cap;
+	}
+	st->burst[st->nburst++] = st->cnt;
+
+	return 0;
+}
+
+static int fakeston_bench_event(struct fakeston_bench_stream *st,
+				uint64_t usec, int type, int code,
+				int32_t value)
+{
+	struct input_event *e;
+
+	if (st->cnt == st->cap) {
+		size_t cap = st->cap ? st->cap * 2 : 4096;
+
+		e = realloc(st->ev, cap * sizeof(*e));
+		if (e == NULL)
+			return -1;
+		st->ev = e;
+		st->cap = cap;
+	}
+
+	e = &st->ev[st->cnt++];
+	e->time.tv_sec = usec / 1000000;
+	e->time.tv_usec = usec % 1000000;
+	e->type = type;
+	e->code = code;
+	e->value = value;
+
+	return 0;
+}
+
+static void fakeston_bench_free(struct fakeston_bench_stream *st)
+{
+	size_t i;
+
+	for (i = 0; i < st->nsetup; i++)
+		free(st->setup[i].payload);
+	free(st->setup);
+	free(st->ev);
+	free(st->burst);
+	memset(st, 0, sizeof(*st));
+}
+
+/* evemu description of a synthetic device */
+static void fakeston_bench_bit(struct evemu_device *dev, int type, int code)
+{
+	dev->mask[EV_SYN][type / 8] |= 1 << (type % 8);
+	dev->mask[type][code / 8] |= 1 << (code % 8);
+}
+
+static void fakeston_bench_abs(struct evemu_device *dev, int code,
+			       int32_t min, int32_t max)
+{
+	fakeston_bench_bit(dev, EV_ABS, code);
+	dev->abs[code].minimum = min;
+	dev->abs[code].maximum = max;
+}
+
+static int fakeston_bench_desc(struct fakeston_bench_stream *st,
+			       struct evemu_device *dev)
+{
+	struct fakeston_bin_rec rec;
+	int type;
+
+	/* evdev.c reads whole bitmasks, every type has one */
+	for (type = 0; type < EV_CNT; type++)
+		dev->mbytes[type] = EVPLAY_NBYTES;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.op = FAKESTON_OP_DESC;
+	rec.size = sizeof(*dev);
+
+	return fakeston_bench_setup_add(st, &rec, dev);
+}
+
+/* relative mouse at 125 Hz, a click every 64 reports */
+static int fakeston_bench_mouse(struct fakeston_bench_stream *st, size_t n)
+{
+	struct evemu_device dev;
+	uint64_t t = 1000000;
+	size_t frame;
+
+	memset(&dev, 0, sizeof(dev));
+	strcpy(dev.name, "fakeston bench mouse");
+	dev.id.bustype = BUS_USB;
+	fakeston_bench_bit(&dev, EV_KEY, BTN_LEFT);
+	fakeston_bench_bit(&dev, EV_KEY, BTN_RIGHT);
+	fakeston_bench_bit(&dev, EV_KEY, BTN_MIDDLE);
+	fakeston_bench_bit(&dev, EV_REL, REL_X);
+	fakeston_bench_bit(&dev, EV_REL, REL_Y);
+	fakeston_bench_bit(&dev, EV_REL, REL_WHEEL);
+
+	st->name = "rel-mouse";
+	if (fakeston_bench_desc(st, &dev) < 0)
+		return -1;
+
+	for (frame = 0; st->cnt < n; frame++, t += 8000) {
+		if (fakeston_bench_burst(st) < 0)
+			return -1;
+		if ((frame % 64) == 32)
+			fakeston_bench_event(st, t, EV_KEY, BTN_LEFT, 1);
+		else if ((frame % 64) == 40)
+			fakeston_bench_event(st, t, EV_KEY, BTN_LEFT, 0);
+		fakeston_bench_event(st, t, EV_REL, REL_X,
+				     fakeston_bench_rand(12));
+		fakeston_bench_event(st, t, EV_REL, REL_Y,
+				     fakeston_bench_rand(12));
+		if (fakeston_bench_event(st, t, EV_SYN, SYN_REPORT, 0) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* pen tablet at 200 Hz, strokes of 200 reports */
+static int fakeston_bench_tablet(struct fakeston_bench_stream *st, size_t n)
+{
+	struct evemu_device dev;
+	uint64_t t = 1000000;
+	int32_t x = 16384, y = 16384;
+	size_t frame;
+
+	memset(&dev, 0, sizeof(dev));
+	strcpy(dev.name, "fakeston bench tablet");
+	dev.id.bustype = BUS_USB;
+	fakeston_bench_bit(&dev, EV_KEY, BTN_TOUCH);
+	fakeston_bench_bit(&dev, EV_KEY, BTN_TOOL_PEN);
+	fakeston_bench_bit(&dev, EV_KEY, BTN_STYLUS);
+	fakeston_bench_abs(&dev, ABS_X, 0, 32767);
+	fakeston_bench_abs(&dev, ABS_Y, 0, 32767);
+	fakeston_bench_abs(&dev, ABS_PRESSURE, 0, 1023);
+
+	st->name = "abs-tablet";
+	if (fakeston_bench_desc(st, &dev) < 0)
+		return -1;
+
+	for (frame = 0; st->cnt < n; frame++, t += 5000) {
+		if (fakeston_bench_burst(st) < 0)
+			return -1;
+		x = (x + fakeston_bench_rand(64)) & 32767;
+		y = (y + fakeston_bench_rand(64)) & 32767;
+		if ((frame % 200) == 0) {
+			fakeston_bench_event(st, t, EV_KEY, BTN_TOOL_PEN, 1);
+			fakeston_bench_event(st, t, EV_KEY, BTN_TOUCH, 1);
+		}
+		fakeston_bench_event(st, t, EV_ABS, ABS_X, x);
+		fakeston_bench_event(st, t, EV_ABS, ABS_Y, y);
+		fakeston_bench_event(st, t, EV_ABS, ABS_PRESSURE,
+				     512 + fakeston_bench_rand(256));
+		if ((frame % 200) == 199) {
+			fakeston_bench_event(st, t, EV_KEY, BTN_TOUCH, 0);
+			fakeston_bench_event(st, t, EV_KEY, BTN_TOOL_PEN, 0);
+		}
+		if (fakeston_bench_event(st, t, EV_SYN, SYN_REPORT, 0) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+#define FAKESTON_BENCH_FINGERS 10
+
+/*
+ * protocol B touchscreen at 100 Hz, strokes of 50 reports with every
+ * finger moving in every report; the panel has as many slots as fingers
+ */
+static int fakeston_bench_touch(struct fakeston_bench_stream *st, size_t n,
+				const char *name, int fingers)
+{
+	struct evemu_device dev;
+	uint64_t t = 1000000;
+	int32_t x[FAKESTON_BENCH_FINGERS], y[FAKESTON_BENCH_FINGERS];
+	int32_t id = 0;
+	size_t frame;
+	int s;
+
+	for (s = 0; s < fingers; s++) {
+		x[s] = 200 + s * 400;
+		y[s] = 1000;
+	}
+
+	memset(&dev, 0, sizeof(dev));
+	strcpy(dev.name, "fakeston bench touchscreen");
+	dev.id.bustype = BUS_USB;
+	fakeston_bench_bit(&dev, EV_KEY, BTN_TOUCH);
+	fakeston_bench_abs(&dev, ABS_X, 0, 4095);
+	fakeston_bench_abs(&dev, ABS_Y, 0, 4095);
+	fakeston_bench_abs(&dev, ABS_MT_SLOT, 0, fingers - 1);
+	fakeston_bench_abs(&dev, ABS_MT_TRACKING_ID, 0, 65535);
+	fakeston_bench_abs(&dev, ABS_MT_POSITION_X, 0, 4095);
+	fakeston_bench_abs(&dev, ABS_MT_POSITION_Y, 0, 4095);
+
+	st->name = name;
+	if (fakeston_bench_desc(st, &dev) < 0)
+		return -1;
+
+	for (frame = 0; st->cnt < n; frame++, t += 10000) {
+		if (fakeston_bench_burst(st) < 0)
+			return -1;
+		for (s = 0; s < fingers; s++) {
+			x[s] = (x[s] + fakeston_bench_rand(16)) & 4095;
+			y[s] = (y[s] + fakeston_bench_rand(16)) & 4095;
+			fakeston_bench_event(st, t, EV_ABS, ABS_MT_SLOT, s);
+			if ((frame % 50) == 0)
+				fakeston_bench_event(st, t, EV_ABS,
+						     ABS_MT_TRACKING_ID, id++);
+			if ((frame % 50) == 49) {
+				fakeston_bench_event(st, t, EV_ABS,
+						     ABS_MT_TRACKING_ID, -1);
+				continue;
+			}
+			fakeston_bench_event(st, t, EV_ABS, ABS_MT_POSITION_X, x[s]);
+			fakeston_bench_event(st, t, EV_ABS, ABS_MT_POSITION_Y, y[s]);
+		}
+		if ((frame % 50) == 0)
+			fakeston_bench_event(st, t, EV_KEY, BTN_TOUCH, 1);
+		else if ((frame % 50) == 49)
+			fakeston_bench_event(st, t, EV_KEY, BTN_TOUCH, 0);
+		fakeston_bench_event(st, t, EV_ABS, ABS_X, x[0]);
+		fakeston_bench_event(st, t, EV_ABS, ABS_Y, y[0]);
+		if (fakeston_bench_event(st, t, EV_SYN, SYN_REPORT, 0) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Recorded streams. The capture is decoded into one stream per device
+ * prepared; the touchpad with the most events is kept.
+ */
+#define FAKESTON_BENCH_CAPTURE_MAX 256
+
+struct fakeston_bench_capture {
+	struct fakeston_bench_stream dev[FAKESTON_BENCH_CAPTURE_MAX];
+	int ndev;
+	int slot[FAKESTON_BENCH_CAPTURE_MAX];	/* slot -> dev, or -1 */
+	int err;
+};
+
+static int fakeston_bench_is_touchpad(const struct evemu_device *dev)
+{
+	return evemu_has_event(dev, EV_ABS, ABS_X) &&
+	       evemu_has_event(dev, EV_KEY, BTN_TOOL_FINGER) &&
+	       !evemu_has_event(dev, EV_KEY, BTN_TOOL_PEN);
+}
+
+static void fakeston_bench_capture_emit(void *data,
+					const struct fakeston_bin_rec *rec,
+					const void *payload)
+{
+	struct fakeston_bench_capture *cap = data;
+	struct fakeston_bench_stream *st;
+	const struct input_event *e = payload;
+	size_t i;
+
+	if (rec->slot >= FAKESTON_BENCH_CAPTURE_MAX)
+		return;
+
+	if (rec->op == FAKESTON_OP_PREPARE) {
+		cap->slot[rec->slot] = -1;
+		if (cap->ndev < FAKESTON_BENCH_CAPTURE_MAX)
+			cap->slot[rec->slot] = cap->ndev++;
+		return;
+	}
+
+	if (cap->slot[rec->slot] < 0)
+		return;
+	st = &cap->dev[cap->slot[rec->slot]];
+
+	switch (rec->op) {
+	case FAKESTON_OP_DESC:
+		if (payload)
+			st->touchpad = fakeston_bench_is_touchpad(payload);
+		/* fall through */
+	case FAKESTON_OP_IOCTLDUMP:
+		if (fakeston_bench_setup_add(st, rec, payload) < 0)
+			cap->err = 1;
+		break;
+	case FAKESTON_OP_BURST:
+		if (fakeston_bench_burst(st) < 0)
+			cap->err = 1;
+		for (i = 0; i < rec->arg; i++)
+			if (fakeston_bench_event(st, e[i].time.tv_sec * 1000000ULL +
+						 e[i].time.tv_usec, e[i].type,
+						 e[i].code, e[i].value) < 0)
+				cap->err = 1;
+		break;
+	case FAKESTON_OP_DESTROY:
+		cap->slot[rec->slot] = -1;
+		break;
+	}
+}
+
+/* the capture is repeated, a second apart, until it is n events long */
+static int fakeston_bench_stretch(struct fakeston_bench_stream *st, size_t n)
+{
+	size_t cnt = st->cnt, nburst = st->nburst, i, b;
+	uint64_t first, span, shift;
+
+	if (cnt == 0)
+		return -1;
+
+	first = st->ev[0].time.tv_sec * 1000000ULL + st->ev[0].time.tv_usec;
+	span = st->ev[cnt - 1].time.tv_sec * 1000000ULL +
+	       st->ev[cnt - 1].time.tv_usec - first;
+
+	for (shift = span + 1000000; st->cnt < n; shift += span + 1000000) {
+		for (b = 0; b < nburst; b++) {
+			size_t end = (b + 1 < nburst) ? st->burst[b + 1] : cnt;
+
+			if (fakeston_bench_burst(st) < 0)
+				return -1;
+			for (i = st->burst[b]; i < end; i++) {
+				const struct input_event *e = &st->ev[i];
+
+				if (fakeston_bench_event(st,
+					e->time.tv_sec * 1000000ULL +
+					e->time.tv_usec + shift,
+					e->type, e->code, e->value) < 0)
+					return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int fakeston_bench_recorded(struct fakeston_bench_stream *st,
+				   const char *filename, size_t n)
+{
+	struct fakeston_bench_capture *cap;
+	struct fakeston_decoder dec;
+	FILE *tcase;
+	int i, best = -1;
+
+	tcase = fakeston_open_case(filename);
+	if (tcase == NULL)
+		return -1;
+
+	cap = calloc(1, sizeof(*cap));
+	if (cap == NULL) {
+		fclose(tcase);
+		return -1;
+	}
+	memset(cap->slot, 0xff, sizeof(cap->slot));
+
+	if (fakeston_decoder_init(&dec, filename,
+				  fakeston_bench_capture_emit, cap) == 0) {
+		fakeston_parse(tcase, fakeston_line_handler, (void*)&dec);
+		fakeston_decoder_release(&dec);
+	}
+	fclose(tcase);
+
+	for (i = 0; i < cap->ndev; i++)
+		if (cap->dev[i].touchpad &&
+		    ((best < 0) || (cap->dev[i].cnt > cap->dev[best].cnt)))
+			best = i;
+
+	if ((best >= 0) && !cap->err) {
+		*st = cap->dev[best];
+		memset(&cap->dev[best], 0, sizeof(cap->dev[best]));
+		st->name = "synaptics";
+	}
+	for (i = 0; i < cap->ndev; i++)
+		fakeston_bench_free(&cap->dev[i]);
+	free(cap);
+
+	if (st->name == NULL)
+		return -1;
+
+	return fakeston_bench_stretch(st, n);
+}
+
+static uint32_t fakeston_bench_ms(const struct input_event *e)
+{
+	return e->time.tv_sec * 1000 + e->time.tv_usec / 1000;
+}
+
+/* one run of a stream down a path, on a new device */
+static int fakeston_bench_run(struct fakeston_bench_stream *st,
+			      enum fakeston_bench_path path,
+			      struct fakeston_bench_result *res)
+{
+	struct weston_mode mode;
+	struct weston_output output;
+	struct fakeston_bench_sink sink;
+	struct fakeston_bin_rec rec;
+	struct evdev_device *device;
+	struct evdev_dispatch *dispatch;
+	struct pload p;
+	uint64_t t0, a0;
+	size_t i, b;
+	int ret = 0;
+
+	memset(&output, 0, sizeof(output));
+	mode.width = 1024;
+	mode.height = 768;
+	output.current = &mode;
+	memset(&sink, 0, sizeof(sink));
+	sink.base.interface = &fakeston_bench_sink_interface;
+
+	if (fakeston_pload_init(&p, &output, FAKESTON_FEED_MEMORY,
+				&sink.base) < 0)
+		return -1;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.op = FAKESTON_OP_PREPARE;
+	rec.id = 1;
+	rec.aux = 1;
+	fakeston_exec(&p, &rec, NULL);
+	for (i = 0; i < st->nsetup; i++) {
+		struct fakeston_bin_rec r = st->setup[i].rec;
+
+		r.id = 1;
+		r.slot = 0;
+		fakeston_exec(&p, &r, st->setup[i].payload);
+	}
+	rec.op = FAKESTON_OP_CREATE;
+	fakeston_exec(&p, &rec, NULL);
+
+	if ((p.slotcap == 0) || (p.slot[0] == NULL) ||
+	    (p.slot[0]->device == NULL)) {
+		fprintf(stderr, "Error: cannot create the %s device\n", st->name);
+		fakeston_pload_release(&p);
+		return -1;
+	}
+	device = p.slot[0]->device;
+	dispatch = device->dispatch;
+	device->pending_events = 0;
+
+	a0 = fakeston_bench_allocs;
+	t0 = fakeston_bench_ns();
+
+	switch (path) {
+	case FAKESTON_BENCH_PROCESS:
+		fixed_p = &p;
+		for (i = 0; i < st->cnt; i++)
+			dispatch->interface->process(dispatch, device, &st->ev[i],
+						     fakeston_bench_ms(&st->ev[i]));
+		fixed_p = NULL;
+		break;
+	case FAKESTON_BENCH_FLUSH:
+		fixed_p = &p;
+		for (i = 0; i < st->cnt; i++) {
+			uint32_t time = fakeston_bench_ms(&st->ev[i]);
+
+			dispatch->interface->process(dispatch, device, &st->ev[i],
+						     time);
+			if (st->ev[i].type == EV_SYN)
+				evdev_flush_motion(device, time);
+		}
+		fixed_p = NULL;
+		break;
+	case FAKESTON_BENCH_EVENTS_LOOP:
+		fixed_p = &p;
+		for (b = 0; b < st->nburst; b++) {
+			size_t end = (b + 1 < st->nburst) ? st->burst[b + 1] : st->cnt;
+			uint32_t time;
+
+			time = device->process_events(device, &st->ev[st->burst[b]],
+						      end - st->burst[b], 0);
+			evdev_flush_motion(device, time);
+		}
+		fixed_p = NULL;
+		break;
+	case FAKESTON_BENCH_DISPATCH:
+		rec.op = FAKESTON_OP_BURST;
+		for (b = 0; b < st->nburst; b++) {
+			size_t end = (b + 1 < st->nburst) ? st->burst[b + 1] : st->cnt;
+			const struct input_event *e = &st->ev[st->burst[b]];
+
+			rec.arg = end - st->burst[b];
+			rec.aux = b;
+			rec.sec = e->time.tv_sec;
+			rec.usec = e->time.tv_usec;
+			fakeston_exec(&p, &rec, e);
+		}
+		break;
+	default:
+		ret = -1;
+	}
+
+	res->ns = fakeston_bench_ns() - t0;
+	res->allocs = fakeston_bench_allocs - a0;
+	res->events = st->cnt;
+	res->notify = sink.notify;
+
+	fakeston_pload_release(&p);
+
+	return ret;
+}
+
+static double
+fakeston_bench_profile(struct weston_motion_filter *filter, void *data,
+		       double velocity, uint32_t time)
+{
+	double factor = velocity * 2.0;
+
+	if (factor > 1.6)
+		factor = 1.6;
+	else if (factor < 0.2)
+		factor = 0.2;
+
+	return factor;
+}
+
+/* keeps the filtered motion from being optimized out */
+static volatile double fakeston_bench_out;
+
+/* about fakeston_bench_profile(), sampled into a lookup table */
+#define FAKESTON_BENCH_SPLINE "spline:0=0.2,0.4=0.8,0.8=1.6"
+
+/*
+ * accelerator_filter on the motion of the mouse stream, one motion at a
+ * time or all of them through weston_filter_dispatch_batch(), with
+ * fakeston_bench_profile() or the given profile
+ */
+static int fakeston_bench_filter(const struct fakeston_bench_stream *st,
+				 int batch,
+				 const struct weston_accel_profile *profile,
+				 struct fakeston_bench_result *res)
+{
+	struct weston_motion_filter *filter;
+	struct weston_motion_params *motion;
+	uint32_t *time;
+	uint64_t t0, a0;
+	size_t i, n = 0;
+
+	motion = calloc(st->nburst, sizeof(*motion));
+	time = calloc(st->nburst, sizeof(*time));
+	filter = weston_accel_profile_filter(profile, fakeston_bench_profile);
+	if ((motion == NULL) || (time == NULL) || (filter == NULL)) {
+		free(motion);
+		free(time);
+		if (filter)
+			filter->interface->destroy(filter);
+		return -1;
+	}
+
+	/* one motion per report */
+	for (i = 0; i < st->cnt; i++) {
+		const struct input_event *e = &st->ev[i];
+
+		if (e->type == EV_REL) {
+			if (e->code == REL_X)
+				motion[n].dx = e->value;
+			else if (e->code == REL_Y)
+				motion[n].dy = e->value;
+			continue;
+		}
+		if ((e->type != EV_SYN) ||
+		    ((motion[n].dx == 0) && (motion[n].dy == 0)) ||
+		    (n + 1 == st->nburst))
+			continue;
+		time[n++] = fakeston_bench_ms(e);
+	}
+
+	a0 = fakeston_bench_allocs;
+	t0 = fakeston_bench_ns();
+
+	if (batch) {
+		weston_filter_dispatch_batch(filter, motion, time, n, NULL);
+	} else {
+		for (i = 0; i < n; i++)
+			weston_filter_dispatch(filter, &motion[i], NULL,
+					       time[i]);
+	}
+
+	res->ns = fakeston_bench_ns() - t0;
+	res->allocs = fakeston_bench_allocs - a0;
+	res->events = n;
+	res->notify = 0;
+
+	for (i = 0; i < n; i++)
+		fakeston_bench_out += motion[i].dx + motion[i].dy;
+
+	filter->interface->destroy(filter);
+	free(motion);
+	free(time);
+
+	return 0;
+}
+
+/* pseudo-random motions for the kernel check: mostly small, some past
+ * the int overflow guard of the kernels, some after long pauses */
+static void fakeston_bench_motions(struct weston_motion_params *motion,
+				   uint32_t *time, long n)
+{
+	uint32_t seed = 1, t = 0;
+	long i;
+
+	for (i = 0; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		if ((seed >> 24) == 0) {
+			motion[i].dx = (int) (seed & 0xffff) - 32768;
+			motion[i].dy = (int) ((seed >> 8) & 0xffff) - 32768;
+		} else {
+			motion[i].dx = (int) ((seed >> 4) & 63) - 32;
+			motion[i].dy = (int) ((seed >> 10) & 63) - 32;
+		}
+		t += ((seed >> 16) & 0xf) == 0 ? 500 : (seed >> 20) & 15;
+		time[i] = t;
+	}
+}
+
+/*
+ * weston_filter_dispatch_batch() with every kernel the CPU runs against
+ * weston_filter_dispatch() one motion at a time, in batches of 1 to 64
+ * motions, the CPU features filter.c is told of cut down to those of the
+ * kernel. Returns the number of kernels with a different result.
+ */
+static int fakeston_bench_kernels(long n)
+{
+	static const struct {
+		int cpu;
+		const char *name;
+	} kernels[] = {
+		{ 0, "scalar" },
+		{ FAKESTON_BENCH_SSE2, "sse2" },
+		{ FAKESTON_BENCH_SSE2 | FAKESTON_BENCH_AVX2, "avx2" },
+	};
+	struct weston_motion_params *in, *ref, *out;
+	struct weston_motion_filter *filter;
+	uint32_t *time;
+	long i, j, count;
+	int k, bad = 0;
+
+	in = calloc(n, sizeof(*in));
+	ref = calloc(n, sizeof(*ref));
+	out = calloc(n, sizeof(*out));
+	time = calloc(n, sizeof(*time));
+	if ((in == NULL) || (ref == NULL) || (out == NULL) || (time == NULL)) {
+		fprintf(stderr, "Error: no memory for the motions\n");
+		bad = -1;
+		goto out;
+	}
+	fakeston_bench_motions(in, time, n);
+
+	filter = weston_accel_profile_filter(NULL, fakeston_bench_profile);
+	if (filter == NULL) {
+		bad = -1;
+		goto out;
+	}
+	memcpy(ref, in, n * sizeof(*in));
+	for (i = 0; i < n; i++)
+		weston_filter_dispatch(filter, &ref[i], NULL, time[i]);
+	filter->interface->destroy(filter);
+
+	for (k = 0; k < (int) ARRAY_LENGTH(kernels); k++) {
+		if ((fakeston_bench_cpu_real() & kernels[k].cpu) !=
+		    kernels[k].cpu) {
+			printf("FAKESTON: BENCH kernel %s not supported, "
+			       "skipped\n", kernels[k].name);
+			continue;
+		}
+		fakeston_bench_cpu = kernels[k].cpu;
+
+		filter = weston_accel_profile_filter(NULL,
+						     fakeston_bench_profile);
+		if (filter == NULL) {
+			bad = -1;
+			break;
+		}
+		memcpy(out, in, n * sizeof(*in));
+		for (i = 0; i < n; i += count) {
+			count = 1 + i % 64;
+			if (count > n - i)
+				count = n - i;
+			weston_filter_dispatch_batch(filter, &out[i], &time[i],
+						     count, NULL);
+		}
+		filter->interface->destroy(filter);
+
+		for (j = 0; j < n; j++)
+			if (memcmp(&out[j], &ref[j], sizeof(out[j])) != 0)
+				break;
+		if (j < n) {
+			printf("FAKESTON: BENCH kernel %s differs at motion "
+			       "%ld: %a %a, scalar path %a %a\n",
+			       kernels[k].name, j, out[j].dx, out[j].dy,
+			       ref[j].dx, ref[j].dy);
+			bad++;
+		} else {
+			printf("FAKESTON: BENCH kernel %s matches over %ld "
+			       "motions\n", kernels[k].name, n);
+		}
+	}
+	fakeston_bench_cpu = ~0;
+
+out:
+	free(in);
+	free(ref);
+	free(out);
+	free(time);
+
+	return bad;
+}
+
+/* get_direction() of filter.c as it was, on atan2 */
+static int fakeston_bench_atan2_direction(int dx, int dy)
+{
+	enum {
+		N  = 1 << 0, NE = 1 << 1, E  = 1 << 2, SE = 1 << 3,
+		S  = 1 << 4, SW = 1 << 5, W  = 1 << 6, NW = 1 << 7,
+		UNDEFINED_DIRECTION = 0xff
+	};
+	int dir = UNDEFINED_DIRECTION;
+	int d1, d2;
+	double r;
+
+	if (abs(dx) < 2 && abs(dy) < 2) {
+		if (dx > 0 && dy > 0)
+			dir = S | SE | E;
+		else if (dx > 0 && dy < 0)
+			dir = N | NE | E;
+		else if (dx < 0 && dy > 0)
+			dir = S | SW | W;
+		else if (dx < 0 && dy < 0)
+			dir = N | NW | W;
+		else if (dx > 0)
+			dir = NW | W | SW;
+		else if (dx < 0)
+			dir = NE | E | SE;
+		else if (dy > 0)
+			dir = SE | S | SW;
+		else if (dy < 0)
+			dir = NE | N | NW;
+	}
+	else {
+		r = atan2(dy, dx);
+		r = fmod(r + 2.5*M_PI, 2*M_PI);
+		r *= 4*M_1_PI;
+
+		d1 = (int)(r + 0.9) % 8;
+		d2 = (int)(r + 0.1) % 8;
+
+		dir = (1 << d1) | (1 << d2);
+	}
+
+	return dir;
+}
+
+/* every dx, dy in [-range, range], returns the number of mismatches */
+static long fakeston_bench_directions(int range)
+{
+	long bad = 0;
+	int dx, dy, a, b;
+
+	for (dx = -range; dx <= range; dx++) {
+		for (dy = -range; dy <= range; dy++) {
+			a = get_direction(dx, dy);
+			b = fakeston_bench_atan2_direction(dx, dy);
+			if (a == b)
+				continue;
+			if (bad++ < 10)
+				printf("FAKESTON: BENCH get_direction(%d, %d) "
+				       "%#x, atan2 %#x\n", dx, dy, a, b);
+		}
+	}
+
+	printf("FAKESTON: BENCH get_direction over [-%d, %d]^2, "
+	       "%ld mismatches\n", range, range, bad);
+
+	return bad;
+}
+
+/* either direction function on the motion of the mouse stream */
+static int fakeston_bench_direction(const struct fakeston_bench_stream *st,
+				    int reference,
+				    struct fakeston_bench_result *res)
+{
+	int (*direction)(int dx, int dy) = reference ?
+		fakeston_bench_atan2_direction : get_direction;
+	int dx = 0, dy = 0, dir = 0;
+	uint64_t t0;
+	size_t i;
+
+	res->events = 0;
+	t0 = fakeston_bench_ns();
+
+	for (i = 0; i < st->cnt; i++) {
+		const struct input_event *e = &st->ev[i];
+
+		if (e->type == EV_REL) {
+			if (e->code == REL_X)
+				dx = e->value;
+			else if (e->code == REL_Y)
+				dy = e->value;
+			continue;
+		}
+		if (e->type != EV_SYN)
+			continue;
+		dir ^= direction(dx, dy);
+		res->events++;
+	}
+
+	res->ns = fakeston_bench_ns() - t0;
+	res->allocs = 0;
+	res->notify = 0;
+	fakeston_bench_out += dir;
+
+	return 0;
+}
+
+static void fakeston_bench_report(const char *stream, const char *path,
+				  const struct fakeston_bench_result *res)
+{
+	double ns = res->events ? (double) res->ns / res->events : 0;
+
+	printf("%-16s %-22s %10llu %14.0f %10.1f %12.3f\n", stream, path,
+	       (unsigned long long) res->events,
+	       res->ns ? res->events * 1e9 / res->ns : 0, ns,
+	       res->events ? (double) res->allocs / res->events : 0);
+}
+
+static void fakeston_bench_best(struct fakeston_bench_result *best,
+				const struct fakeston_bench_result *res,
+				int first)
+{
+	if (first || (res->ns < best->ns))
+		*best = *res;
+}
+
+static void fakeston_bench_usage(void)
+{
+	fprintf(stderr, "fakeston_bench [-n events] [-r runs] [ftestcase.txt]\n"
+		"fakeston_bench -d range\n"
+		"fakeston_bench -k motions\n\n"
+		" ftestcase.txt - capture with a touchpad to replay, default\n"
+		"                 " FAKESTON_BENCH_CAPTURE "\n"
+		" -n, --events N - events in every stream (default %d)\n"
+		" -r, --runs N - runs of every benchmark, the best counts\n"
+		"                (default %d)\n"
+		" -d, --directions N - check get_direction() against atan2\n"
+		"                      for every dx, dy in [-N, N]\n"
+		" -k, --kernels N - check the batch filter with every vector\n"
+		"                   kernel on N motions\n",
+		FAKESTON_BENCH_EVENTS, FAKESTON_BENCH_REPEAT);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option opts[] = {
+		{ "events", required_argument, NULL, 'n' },
+		{ "runs", required_argument, NULL, 'r' },
+		{ "directions", required_argument, NULL, 'd' },
+		{ "kernels", required_argument, NULL, 'k' },
+		{ NULL, 0, NULL, 0 }
+	};
+	static const char *path_names[FAKESTON_BENCH_PATH_CNT] = {
+		[FAKESTON_BENCH_PROCESS] = NULL,
+		[FAKESTON_BENCH_FLUSH] = "+evdev_flush_motion",
+		[FAKESTON_BENCH_EVENTS_LOOP] = "process_events",
+		[FAKESTON_BENCH_DISPATCH] = "evdev_device_data",
+	};
+	static const char *filter_names[3] = {
+		"accelerator_filter", "filter_dispatch_batch", "spline profile"
+	};
+	struct weston_accel_profile *spline = NULL;
+	struct fakeston_bench_stream st[5];
+	struct fakeston_bench_result res, best;
+	const char *capture = FAKESTON_BENCH_CAPTURE;
+	long events = FAKESTON_BENCH_EVENTS;
+	int runs = FAKESTON_BENCH_REPEAT;
+	int range = -1;
+	long motions = -1;
+	int c, i, r, path, nst = 0, ret = 0;
+
+	while ((c = getopt_long(argc, argv, "n:r:d:k:", opts, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			events = atol(optarg);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'd':
+			range = atoi(optarg);
+			break;
+		case 'k':
+			motions = atol(optarg);
+			break;
+		default:
+			fakeston_bench_usage();
+			return -1;
+		}
+	}
+	if ((events < 1) || (runs < 1) || (optind + 1 < argc)) {
+		fakeston_bench_usage();
+		return -1;
+	}
+	if (optind < argc)
+		capture = argv[optind];
+
+	if (range >= 0)
+		return fakeston_bench_directions(range) ? 1 : 0;
+	if (motions >= 0)
+		return fakeston_bench_kernels(motions) ? 1 : 0;
+
+	memset(st, 0, sizeof(st));
+	if ((fakeston_bench_mouse(&st[nst++], events) < 0) ||
+	    (fakeston_bench_tablet(&st[nst++], events) < 0) ||
+	    (fakeston_bench_touch(&st[nst++], events, "mt-touchscreen",
+				  2) < 0) ||
+	    (fakeston_bench_touch(&st[nst++], events, "mt-10finger",
+				  FAKESTON_BENCH_FINGERS) < 0)) {
+		fprintf(stderr, "Error: no memory for the streams\n");
+		ret = -1;
+		goto out;
+	}
+	if (fakeston_bench_recorded(&st[nst], capture, events) == 0)
+		nst++;
+	else
+		fprintf(stderr, "FAKESTON: BENCH no touchpad from '%s', "
+			"skipped\n", capture);
+
+	printf("FAKESTON: BENCH best of %d runs\n", runs);
+	printf("%-16s %-22s %10s %14s %10s %12s\n", "stream", "path",
+	       "events", "events/s", "ns/event", "allocs/event");
+
+	for (i = 0; i < nst; i++) {
+		for (path = 0; path < FAKESTON_BENCH_PATH_CNT; path++) {
+			const char *name = path_names[path];
+
+			for (r = 0; r < runs; r++) {
+				if (fakeston_bench_run(&st[i], path, &res) < 0) {
+					ret = -1;
+					goto out;
+				}
+				fakeston_bench_best(&best, &res, r == 0);
+			}
+			if (name == NULL)
+				name = st[i].touchpad ? "touchpad_process" :
+							"fallback_process";
+			fakeston_bench_report(st[i].name, name, &best);
+		}
+	}
+
+	spline = weston_accel_profile_create(FAKESTON_BENCH_SPLINE);
+	for (i = 0; i < 3; i++) {
+		for (r = 0; r < runs; r++) {
+			if (fakeston_bench_filter(&st[0], i == 1,
+						  i == 2 ? spline : NULL,
+						  &res) < 0) {
+				ret = -1;
+				goto out;
+			}
+			fakeston_bench_best(&best, &res, r == 0);
+		}
+		fakeston_bench_report(st[0].name, filter_names[i], &best);
+	}
+
+	for (i = 0; i < 2; i++) {
+		for (r = 0; r < runs; r++) {
+			fakeston_bench_direction(&st[0], i, &res);
+			fakeston_bench_best(&best, &res, r == 0);
+		}
+		fakeston_bench_report(st[0].name, i ? "atan2 get_direction" :
+					      "get_direction", &best);
+	}
+
+out:
+	for (i = 0; i < 5; i++)
+		fakeston_bench_free(&st[i]);
+	if (spline)
+		weston_accel_profile_destroy(spline);
+
+	return ret;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fakeston.h"
+
+static void fakeston_compile_emit(void *data, const struct fakeston_bin_rec *rec,
+				  const void *payload)
+{
+	static const char pad[8];
+	FILE *out = (FILE *) data;
+	size_t padding = FAKESTON_BIN_ALIGN(rec->size) - rec->size;
+
+	fwrite(rec, sizeof(*rec), 1, out);
+	if (rec->size)
+		fwrite(payload, rec->size, 1, out);
+	if (padding)
+		fwrite(pad, padding, 1, out);
+}
+
+int fakeston_compile(const char *filename, const char *outname)
+{
+	struct fakeston_bin_header hdr;
+	struct fakeston_decoder dec;
+	FILE *tcase, *out;
+	int ret = 0;
+
+	tcase = fakeston_open_case(filename);
+	if (tcase == NULL)
+		return -2;
+
+	out = fopen(outname, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Error: cannot create '%s'\n", outname);
+		fclose(tcase);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, FAKESTON_BIN_MAGIC, sizeof(hdr.magic));
+	hdr.format = FAKESTON_BIN_FORMAT;
+	hdr.rec_size = sizeof(struct fakeston_bin_rec);
+	hdr.event_size = sizeof(struct input_event);
+	hdr.desc_size = sizeof(struct evemu_device);
+	fwrite(&hdr, sizeof(hdr), 1, out);
+
+	if (fakeston_decoder_init(&dec, filename, fakeston_compile_emit, out) == 0) {
+		fakeston_parse(tcase, fakeston_line_handler, (void *)&dec);
+		fakeston_decoder_release(&dec);
+	} else {
+		ret = -4;
+	}
+
+	fclose(tcase);
+
+	if (ferror(out))
+		ret = -4;
+	if (fclose(out) != 0)
+		ret = -4;
+
+	if (ret < 0) {
+		fprintf(stderr, "Error: cannot write '%s'\n", outname);
+		unlink(outname);
+	}
+
+	return ret;
+}
@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "fakeston.h"
+
+/*
+ * Device descriptor cache. Captures of the same hardware carry the same
+ * evemudesc files over and over, so decoded descriptors are kept once per
+ * process and shared, read only, by every device and every batch job that
+ * uses them. Entries are found by a hash of their content: of the
+ * evemudesc text when loading a file, of the decoded descriptor when it
+ * comes from a compiled test case. Descriptors nobody uses stay cached up
+ * to FAKESTON_DESC_IDLE_MAX of them.
+ */
+
+#define FAKESTON_DESC_IDLE_MAX 64
+
+static struct {
+	pthread_mutex_t lock;
+	struct fakeston_map by_dev;	/* hash of dev -> fakeston_desc */
+	struct fakeston_map by_text;	/* hash of evemudesc text -> fakeston_desc */
+	size_t idle;			/* entries with no reference */
+} fakeston_desc_cache = {
+	PTHREAD_MUTEX_INITIALIZER,
+};
+
+int evemu_has_event(const struct evemu_device *dev, int type, int code);
+
+static void read_prop(struct evemu_device *dev, FILE *fp)
+{
+	unsigned int mask[8];
+	int i;
+	while (fscanf(fp, "P: %02x %02x %02x %02x %02x %02x %02x %02x\n",
+		      mask + 0, mask + 1, mask + 2, mask + 3,
+		      mask + 4, mask + 5, mask + 6, mask + 7) > 0) {
+		for (i = 0; i < 8; i++)
+			dev->prop[dev->pbytes++] = mask[i];
+	}
+}
+
+static void read_mask(struct evemu_device *dev, FILE *fp)
+{
+	unsigned int mask[8];
+	int index, i;
+	while (fscanf(fp, "B: %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
+		      &index, mask + 0, mask + 1, mask + 2, mask + 3,
+		      mask + 4, mask + 5, mask + 6, mask + 7) > 0) {
+		for (i = 0; i < 8; i++)
+			dev->mask[index][dev->mbytes[index]++] = mask[i];
+	}
+}
+
+static void read_abs(struct evemu_device *dev, FILE *fp)
+{
+	struct input_absinfo abs;
+	int index;
+	while (fscanf(fp, "A: %02x %d %d %d %d\n", &index,
+		      &abs.minimum, &abs.maximum, &abs.fuzz, &abs.flat) > 0)
+		dev->abs[index] = abs;
+}
+
+static int fakeston_read_desc(struct evemu_device *dev, FILE *fp)
+{
+	unsigned bustype, vendor, product, version;
+	int ret;
+
+	memset(dev, 0, sizeof(*dev));
+
+	ret = fscanf(fp, "N: %79[^\n]\n", dev->name);
+	if (ret <= 0)
+		return 0;
+
+	ret = fscanf(fp, "I: %04x %04x %04x %04x\n",
+		     &bustype, &vendor, &product, &version);
+	dev->id.bustype = bustype;
+	dev->id.vendor = vendor;
+	dev->id.product = product;
+	dev->id.version = version;
+
+	read_prop(dev, fp);
+	read_mask(dev, fp);
+	read_abs(dev, fp);
+
+	return 1;
+}
+
+/* FNV-1a, never one of the reserved map keys */
+static uintptr_t fakeston_desc_hash(const void *buf, size_t len)
+{
+	const unsigned char *c = buf;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	uintptr_t key;
+
+	while (len--) {
+		h ^= *c++;
+		h *= 0x100000001b3ULL;
+	}
+
+	key = (uintptr_t) (h ^ (h >> 32));
+	if ((key == 0) || (key == ~(uintptr_t) 0))
+		key = 1;
+
+	return key;
+}
+
+static struct fakeston_desc *fakeston_desc_new(const struct evemu_device *dev)
+{
+	struct fakeston_desc *desc;
+	int index;
+
+	desc = calloc(1, sizeof(*desc));
+	if (desc == NULL)
+		return NULL;
+
+	desc->dev = *dev;
+	desc->key = fakeston_desc_hash(dev, sizeof(*dev));
+	for (index = 0; index < 64; index++)
+		if (evemu_has_event(dev, EV_ABS, index))
+			desc->is_abs |= (uint64_t) 1 << index;
+
+	return desc;
+}
+
+static void fakeston_desc_free(struct fakeston_desc *desc)
+{
+	free(desc->text);
+	free(desc);
+}
+
+/* called locked */
+static int fakeston_desc_init_locked(void)
+{
+	if (fakeston_desc_cache.by_dev.e != NULL)
+		return 0;
+
+	if (fakeston_map_init(&fakeston_desc_cache.by_dev, 64) < 0)
+		return -1;
+	if (fakeston_map_init(&fakeston_desc_cache.by_text, 64) < 0) {
+		fakeston_map_release(&fakeston_desc_cache.by_dev);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* called locked */
+static void fakeston_desc_ref_locked(struct fakeston_desc *desc)
+{
+	if ((desc->ref++ == 0) && desc->cached)
+		fakeston_desc_cache.idle--;
+}
+
+/*
+ * Puts a new descriptor in the cache, or returns the cached one with the
+ * same content. A hash collision leaves the new one uncached, it is freed
+ * with its last reference. Called locked.
+ */
+static struct fakeston_desc *fakeston_desc_insert_locked(struct fakeston_desc *desc)
+{
+	struct fakeston_desc *old;
+
+	old = fakeston_map_get(&fakeston_desc_cache.by_dev, desc->key);
+	if (old && (0 == memcmp(&old->dev, &desc->dev, sizeof(desc->dev)))) {
+		fakeston_desc_free(desc);
+		return old;
+	}
+
+	if ((old == NULL) &&
+	    (fakeston_map_put(&fakeston_desc_cache.by_dev, desc->key, desc) == 0)) {
+		desc->cached = 1;
+		fakeston_desc_cache.idle++;
+	}
+
+	return desc;
+}
+
+const struct fakeston_desc *fakeston_desc_get(const struct evemu_device *dev)
+{
+	uintptr_t key = fakeston_desc_hash(dev, sizeof(*dev));
+	struct fakeston_desc *desc;
+
+	pthread_mutex_lock(&fakeston_desc_cache.lock);
+	if (fakeston_desc_init_locked() < 0) {
+		pthread_mutex_unlock(&fakeston_desc_cache.lock);
+		return NULL;
+	}
+
+	desc = fakeston_map_get(&fakeston_desc_cache.by_dev, key);
+	if ((desc == NULL) ||
+	    (0 != memcmp(&desc->dev, dev, sizeof(*dev)))) {
+		desc = fakeston_desc_new(dev);
+		if (desc)
+			desc = fakeston_desc_insert_locked(desc);
+	}
+	if (desc)
+		fakeston_desc_ref_locked(desc);
+	pthread_mutex_unlock(&fakeston_desc_cache.lock);
+
+	return desc;
+}
+
+/* reads a whole evemudesc file, returns its length or -1 */
+static ssize_t fakeston_desc_slurp(int fd, char **text)
+{
+	size_t len = 0, cap = 4096;
+	char *buf = malloc(cap);
+	ssize_t n;
+
+	if (buf == NULL)
+		return -1;
+
+	while ((n = read(fd, buf + len, cap - len)) > 0) {
+		len += n;
+		if (len == cap) {
+			char *b = realloc(buf, cap * 2);
+			if (b == NULL) {
+				free(buf);
+				return -1;
+			}
+			buf = b;
+			cap *= 2;
+		}
+	}
+
+	*text = buf;
+	return len;
+}
+
+const struct fakeston_desc *fakeston_desc_load(int fd)
+{
+	struct evemu_device *dev;
+	struct fakeston_desc *desc;
+	uintptr_t key;
+	char *text;
+	ssize_t len;
+	FILE *fp;
+	int ok;
+
+	len = fakeston_desc_slurp(fd, &text);
+	if (len < 0)
+		return NULL;
+	key = fakeston_desc_hash(text, len);
+
+	pthread_mutex_lock(&fakeston_desc_cache.lock);
+	if (fakeston_desc_init_locked() < 0) {
+		pthread_mutex_unlock(&fakeston_desc_cache.lock);
+		free(text);
+		return NULL;
+	}
+
+	desc = fakeston_map_get(&fakeston_desc_cache.by_text, key);
+	if (desc && (desc->text_len == (size_t) len) &&
+	    (0 == memcmp(desc->text, text, len))) {
+		fakeston_desc_ref_locked(desc);
+		pthread_mutex_unlock(&fakeston_desc_cache.lock);
+		free(text);
+		return desc;
+	}
+	pthread_mutex_unlock(&fakeston_desc_cache.lock);
+
+	/* not seen yet, parse it outside the lock */
+	dev = malloc(sizeof(*dev));
+	fp = len ? fmemopen(text, len, "r") : NULL;
+	ok = dev && fp && fakeston_read_desc(dev, fp);
+	if (fp)
+		fclose(fp);
+	desc = ok ? fakeston_desc_new(dev) : NULL;
+	free(dev);
+	if (desc == NULL) {
+		free(text);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fakeston_desc_cache.lock);
+	desc = fakeston_desc_insert_locked(desc);
+	if (desc->cached && (desc->text == NULL) &&
+	    (fakeston_map_get(&fakeston_desc_cache.by_text, key) == NULL) &&
+	    (fakeston_map_put(&fakeston_desc_cache.by_text, key, desc) == 0)) {
+		desc->text = text;
+		desc->text_len = len;
+		desc->text_key = key;
+		text = NULL;
+	}
+	fakeston_desc_ref_locked(desc);
+	pthread_mutex_unlock(&fakeston_desc_cache.lock);
+
+	free(text);
+	return desc;
+}
+
+void fakeston_desc_put(const struct fakeston_desc *cdesc)
+{
+	struct fakeston_desc *desc = (struct fakeston_desc *) cdesc;
+
+	if (desc == NULL)
+		return;
+
+	pthread_mutex_lock(&fakeston_desc_cache.lock);
+	if (--desc->ref > 0) {
+		pthread_mutex_unlock(&fakeston_desc_cache.lock);
+		return;
+	}
+
+	if (desc->cached && (fakeston_desc_cache.idle < FAKESTON_DESC_IDLE_MAX)) {
+		fakeston_desc_cache.idle++;
+		pthread_mutex_unlock(&fakeston_desc_cache.lock);
+		return;
+	}
+
+	if (desc->cached) {
+		fakeston_map_del(&fakeston_desc_cache.by_dev, desc->key);
+		if (desc->text)
+			fakeston_map_del(&fakeston_desc_cache.by_text,
+					 desc->text_key);
+	}
+	pthread_mutex_unlock(&fakeston_desc_cache.lock);
+
+	fakeston_desc_free(desc);
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fakeston.h"
+
+/*
+ * Event loop of the replay. Fd sources are only bookkeeping, bursts call
+ * their callback directly. Timer sources live in a binary min-heap ordered
+ * by deadline and arming order, the replay advances the virtual clock to
+ * each burst timestamp and fires whatever came due on the way.
+ */
+
+static int
+fakeston_timer_dispatch(struct wl_event_source *source, struct epoll_event *ep)
+{
+	struct wl_event_source_timer *timer_source =
+		(struct wl_event_source_timer *) source;
+
+	return timer_source->func(timer_source->base.data);
+}
+
+static struct wl_event_source_interface timer_source_interface = {
+	fakeston_timer_dispatch,
+};
+
+static int
+fakeston_timer_before(const struct fakeston_timer *a,
+		      const struct fakeston_timer *b)
+{
+	if (a->deadline != b->deadline)
+		return a->deadline < b->deadline;
+
+	return a->serial < b->serial;
+}
+
+static void
+fakeston_heap_set(struct wl_event_loop *loop, size_t i, struct fakeston_timer *t)
+{
+	loop->heap[i] = t;
+	t->heap = i;
+}
+
+static void
+fakeston_heap_up(struct wl_event_loop *loop, size_t i)
+{
+	struct fakeston_timer *t = loop->heap[i];
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+
+		if (!fakeston_timer_before(t, loop->heap[parent]))
+			break;
+		fakeston_heap_set(loop, i, loop->heap[parent]);
+		i = parent;
+	}
+	fakeston_heap_set(loop, i, t);
+}
+
+static void
+fakeston_heap_down(struct wl_event_loop *loop, size_t i)
+{
+	struct fakeston_timer *t = loop->heap[i];
+
+	for (;;) {
+		size_t child = 2 * i + 1;
+
+		if (child >= loop->cnt)
+			break;
+		if ((child + 1 < loop->cnt) &&
+		    fakeston_timer_before(loop->heap[child + 1], loop->heap[child]))
+			child++;
+		if (!fakeston_timer_before(loop->heap[child], t))
+			break;
+		fakeston_heap_set(loop, i, loop->heap[child]);
+		i = child;
+	}
+	fakeston_heap_set(loop, i, t);
+}
+
+static void
+fakeston_heap_remove(struct wl_event_loop *loop, struct fakeston_timer *t)
+{
+	size_t i = t->heap;
+	struct fakeston_timer *last;
+
+	t->heap = FAKESTON_TIMER_IDLE;
+	last = loop->heap[--loop->cnt];
+	if (last == t)
+		return;
+
+	fakeston_heap_set(loop, i, last);
+	if ((i > 0) && fakeston_timer_before(last, loop->heap[(i - 1) / 2]))
+		fakeston_heap_up(loop, i);
+	else
+		fakeston_heap_down(loop, i);
+}
+
+static int
+fakeston_heap_insert(struct wl_event_loop *loop, struct fakeston_timer *t)
+{
+	if (loop->cnt == loop->cap) {
+		size_t cap = loop->cap ? loop->cap * 2 : 16;
+		struct fakeston_timer **heap;
+
+		heap = realloc(loop->heap, cap * sizeof(heap[0]));
+		if (heap == NULL)
+			return -1;
+		loop->heap = heap;
+		loop->cap = cap;
+	}
+
+	loop->heap[loop->cnt] = t;
+	fakeston_heap_up(loop, loop->cnt++);
+
+	return 0;
+}
+
+void fakeston_loop_init(struct wl_event_loop *loop)
+{
+	memset(loop, 0, sizeof(*loop));
+}
+
+void fakeston_loop_release(struct wl_event_loop *loop)
+{
+	size_t i;
+
+	/* timers still armed belong to sources nobody removed */
+	for (i = 0; i < loop->cnt; i++)
+		loop->heap[i]->heap = FAKESTON_TIMER_IDLE;
+
+	free(loop->heap);
+	loop->heap = NULL;
+	loop->cnt = loop->cap = 0;
+}
+
+/*
+ * Fires every timer due at or before now, in deadline order. The clock
+ * steps to each deadline first, so a handler reading the time or rearming
+ * itself sees the moment it was meant to run at. The clock never goes
+ * backwards.
+ */
+void fakeston_loop_advance(struct wl_event_loop *loop, uint64_t now)
+{
+	while ((loop->cnt > 0) && (loop->heap[0]->deadline <= now)) {
+		struct fakeston_timer *t = loop->heap[0];
+
+		fakeston_heap_remove(loop, t);
+		if (t->deadline > loop->now)
+			loop->now = t->deadline;
+
+		t->base.base.interface->dispatch(&t->base.base, NULL);
+	}
+
+	if (now > loop->now)
+		loop->now = now;
+}
+
+struct wl_event_loop *wl_display_get_event_loop(struct wl_display *display)
+{
+	return &display->loop;
+}
+
+struct wl_event_source *wl_event_loop_add_timer(struct wl_event_loop *loop,
+						wl_event_loop_timer_func_t func,
+						void *data)
+{
+	struct fakeston_timer *t;
+
+	t = malloc(sizeof(struct fakeston_timer));
+	if (t == NULL)
+		return NULL;
+
+	memset(t, 0, sizeof(*t));
+	t->base.base.interface = &timer_source_interface;
+	t->base.base.loop = loop;
+	t->base.base.data = data;
+	t->base.base.fd = -1;
+	t->base.func = func;
+	t->heap = FAKESTON_TIMER_IDLE;
+
+	return &t->base.base;
+}
+
+int wl_event_source_timer_update(struct wl_event_source *source,
+				 int ms_delay)
+{
+	struct fakeston_timer *t = (struct fakeston_timer *) source;
+	struct wl_event_loop *loop = source->loop;
+
+	if (t->heap != FAKESTON_TIMER_IDLE)
+		fakeston_heap_remove(loop, t);
+
+	/* like timerfd, zero disarms */
+	if (ms_delay <= 0)
+		return 0;
+
+	t->deadline = loop->now + ms_delay;
+	t->serial = loop->serial++;
+
+	return fakeston_heap_insert(loop, t);
+}
+
+int wl_event_source_remove(struct wl_event_source *source)
+{
+	if (source->interface == &timer_source_interface) {
+		struct fakeston_timer *t = (struct fakeston_timer *) source;
+
+		if (t->heap != FAKESTON_TIMER_IDLE)
+			fakeston_heap_remove(source->loop, t);
+	}
+
+	free(source);
+	return 0;
+}
+
+struct wl_event_source *wl_event_loop_add_fd(struct wl_event_loop *loop,
+					     int fd, uint32_t mask,
+					     wl_event_loop_fd_func_t func,
+					     void *data)
+{
+	struct wl_event_source_fd *new;
+	new = malloc(sizeof(struct wl_event_source_fd));
+	if (new == NULL)
+		return NULL;
+
+	new->base.interface = NULL;
+	new->base.loop = loop;
+	new->base.data = data;
+	new->base.fd = fd;
+	new->func = func;
+	new->fd = fd;
+
+	return (struct wl_event_source *) new;
+}
+
+uint32_t
+weston_compositor_get_time(void)
+{
+	if (fixed_p == NULL)
+		return 0;
+
+	return (uint32_t) fixed_p->display.loop.now;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fakeston.h"
+
+/*
+ * Open addressing, linear probing, power of two capacity. Deleted entries
+ * leave a tombstone so that probe chains stay intact; the table is rebuilt
+ * when live entries plus tombstones pass 3/4 of the capacity, doubling it
+ * only when the live entries alone need the room.
+ */
+
+#define FAKESTON_MAP_EMPTY	((uintptr_t) 0)
+#define FAKESTON_MAP_TOMB	(~(uintptr_t) 0)
+
+static size_t
+fakeston_map_hash(uintptr_t key, size_t mask)
+{
+	uint64_t h = (uint64_t) key * 0x9e3779b97f4a7c15ULL;
+
+	return (size_t) (h ^ (h >> 32)) & mask;
+}
+
+int
+fakeston_map_init(struct fakeston_map *m, size_t cap)
+{
+	size_t n = 8;
+
+	while (n < cap)
+		n <<= 1;
+
+	m->e = calloc(n, sizeof(*m->e));
+	if (m->e == NULL)
+		return -1;
+	m->cap = n;
+	m->cnt = 0;
+	m->used = 0;
+
+	return 0;
+}
+
+void
+fakeston_map_release(struct fakeston_map *m)
+{
+	free(m->e);
+	m->e = NULL;
+	m->cap = m->cnt = m->used = 0;
+}
+
+static struct fakeston_map_entry *
+fakeston_map_find(const struct fakeston_map *m, uintptr_t key)
+{
+	size_t mask = m->cap - 1;
+	size_t i = fakeston_map_hash(key, mask);
+
+	/* the load factor guarantees an empty entry ends every chain */
+	while (m->e[i].key != key) {
+		if (m->e[i].key == FAKESTON_MAP_EMPTY)
+			return NULL;
+		i = (i + 1) & mask;
+	}
+
+	return &m->e[i];
+}
+
+void *
+fakeston_map_get(const struct fakeston_map *m, uintptr_t key)
+{
+	struct fakeston_map_entry *e;
+
+	if ((key == FAKESTON_MAP_EMPTY) || (key == FAKESTON_MAP_TOMB))
+		return NULL;
+
+	e = fakeston_map_find(m, key);
+
+	return e ? e->val : NULL;
+}
+
+static int
+fakeston_map_rehash(struct fakeston_map *m, size_t cap)
+{
+	struct fakeston_map_entry *old = m->e;
+	size_t oldcap = m->cap, mask = cap - 1, i, j;
+
+	m->e = calloc(cap, sizeof(*m->e));
+	if (m->e == NULL) {
+		m->e = old;
+		return -1;
+	}
+	m->cap = cap;
+	m->used = m->cnt;
+
+	for (i = 0; i < oldcap; i++) {
+		if ((old[i].key == FAKESTON_MAP_EMPTY) ||
+		    (old[i].key == FAKESTON_MAP_TOMB))
+			continue;
+
+		j = fakeston_map_hash(old[i].key, mask);
+		while (m->e[j].key != FAKESTON_MAP_EMPTY)
+			j = (j + 1) & mask;
+		m->e[j] = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+int
+fakeston_map_put(struct fakeston_map *m, uintptr_t key, void *val)
+{
+	struct fakeston_map_entry *e;
+	size_t mask, i, tomb;
+
+	if ((key == FAKESTON_MAP_EMPTY) || (key == FAKESTON_MAP_TOMB))
+		return -1;
+
+	e = fakeston_map_find(m, key);
+	if (e) {
+		e->val = val;
+		return 0;
+	}
+
+	if ((m->used + 1) * 4 > m->cap * 3) {
+		size_t cap = m->cap;
+
+		if ((m->cnt + 1) * 2 > cap)
+			cap <<= 1;
+		if (fakeston_map_rehash(m, cap) < 0)
+			return -1;
+	}
+
+	mask = m->cap - 1;
+	i = fakeston_map_hash(key, mask);
+	tomb = m->cap;
+	while (m->e[i].key != FAKESTON_MAP_EMPTY) {
+		if ((m->e[i].key == FAKESTON_MAP_TOMB) && (tomb == m->cap))
+			tomb = i;
+		i = (i + 1) & mask;
+	}
+
+	/* reuse the first tombstone of the chain */
+	if (tomb != m->cap)
+		i = tomb;
+	else
+		m->used++;
+
+	m->e[i].key = key;
+	m->e[i].val = val;
+	m->cnt++;
+
+	return 0;
+}
+
+void *
+fakeston_map_del(struct fakeston_map *m, uintptr_t key)
+{
+	struct fakeston_map_entry *e;
+	void *val;
+
+	if ((key == FAKESTON_MAP_EMPTY) || (key == FAKESTON_MAP_TOMB))
+		return NULL;
+
+	e = fakeston_map_find(m, key);
+	if (e == NULL)
+		return NULL;
+
+	val = e->val;
+	e->key = FAKESTON_MAP_TOMB;
+	e->val = NULL;
+	m->cnt--;
+
+	return val;
+}
+
+void
+fakeston_map_for_each(struct fakeston_map *m,
+		      void (*func)(void *val, void *data), void *data)
+{
+	size_t i;
+
+	for (i = 0; i < m->cap; i++)
+		if ((m->e[i].key != FAKESTON_MAP_EMPTY) &&
+		    (m->e[i].key != FAKESTON_MAP_TOMB))
+			func(m->e[i].val, data);
+}
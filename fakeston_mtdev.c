@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fakeston.h"
+#include "evdev.h"
+
+/*
+ * Stand-in for libmtdev, enough for evdev.c. It reads protocol A events
+ * from the device fd, which the replay feeds, and turns every frame into
+ * protocol B: contacts are matched to the slots of the previous frame by
+ * their tracking id when the device reports one, else by distance, and
+ * only the values that changed are sent. evdev.c keeps struct mtdev
+ * opaque, so the state lives in struct fakeston_mtdev.
+ */
+
+#define FAKESTON_MT_FIRST	ABS_MT_TOUCH_MAJOR
+#define FAKESTON_MT_LAST	ABS_MT_TOOL_Y
+#define FAKESTON_MT_CNT		(FAKESTON_MT_LAST - FAKESTON_MT_FIRST + 1)
+#define FAKESTON_MT_BIT(code)	(1u << ((code) - FAKESTON_MT_FIRST))
+
+/* worst case output of one input event: a frame releasing or filling
+ * every slot, then the SYN_REPORT */
+#define FAKESTON_MTDEV_FRAME	(MAX_SLOTS * (2 + FAKESTON_MT_CNT) + 1)
+#define FAKESTON_MTDEV_QUEUE	(4 * FAKESTON_MTDEV_FRAME)
+#define FAKESTON_MTDEV_RAW	64
+
+struct fakeston_mt_contact {
+	int32_t val[FAKESTON_MT_CNT];	/* by code - ABS_MT_TOUCH_MAJOR */
+	uint32_t has;			/* FAKESTON_MT_BIT of each val set */
+};
+
+struct fakeston_mtdev {
+	/* protocol A frame being read */
+	struct fakeston_mt_contact in[MAX_SLOTS];
+	int nin;
+
+	/* protocol B state sent so far */
+	struct fakeston_mt_contact slot[MAX_SLOTS];
+	int32_t id[MAX_SLOTS];		/* tracking id, -1 if the slot is free */
+	int32_t next_id;
+	int out_slot;
+
+	/* converted events not yet taken by mtdev_get */
+	struct input_event q[FAKESTON_MTDEV_QUEUE];
+	size_t head, tail;
+
+	struct input_event raw[FAKESTON_MTDEV_RAW];
+	size_t rpos, rcnt;
+};
+
+static void
+fakeston_mtdev_push(struct fakeston_mtdev *m, const struct timeval *time,
+		    int type, int code, int32_t value)
+{
+	struct input_event *e = &m->q[m->tail++];
+
+	e->time = *time;
+	e->type = type;
+	e->code = code;
+	e->value = value;
+}
+
+static void
+fakeston_mtdev_select(struct fakeston_mtdev *m, const struct timeval *time,
+		      int s)
+{
+	if (m->out_slot == s)
+		return;
+
+	fakeston_mtdev_push(m, time, EV_ABS, ABS_MT_SLOT, s);
+	m->out_slot = s;
+}
+
+static int64_t
+fakeston_mtdev_dist(const struct fakeston_mt_contact *a,
+		    const struct fakeston_mt_contact *b)
+{
+	int64_t dx = (int64_t) a->val[ABS_MT_POSITION_X - FAKESTON_MT_FIRST] -
+		     b->val[ABS_MT_POSITION_X - FAKESTON_MT_FIRST];
+	int64_t dy = (int64_t) a->val[ABS_MT_POSITION_Y - FAKESTON_MT_FIRST] -
+		     b->val[ABS_MT_POSITION_Y - FAKESTON_MT_FIRST];
+
+	return dx * dx + dy * dy;
+}
+
+/* fills map[slot] with the index of the contact that goes there, or -1 */
+static void
+fakeston_mtdev_match(struct fakeston_mtdev *m, int *map)
+{
+	const uint32_t tid = FAKESTON_MT_BIT(ABS_MT_TRACKING_ID);
+	int taken[MAX_SLOTS] = { 0 };
+	int i, s;
+
+	for (s = 0; s < MAX_SLOTS; s++)
+		map[s] = -1;
+
+	/* same tracking id as before, same slot */
+	for (i = 0; i < m->nin; i++) {
+		if (!(m->in[i].has & tid))
+			continue;
+		for (s = 0; s < MAX_SLOTS; s++) {
+			if ((m->id[s] >= 0) && (map[s] < 0) &&
+			    (m->slot[s].has & tid) &&
+			    (m->slot[s].val[ABS_MT_TRACKING_ID - FAKESTON_MT_FIRST] ==
+			     m->in[i].val[ABS_MT_TRACKING_ID - FAKESTON_MT_FIRST])) {
+				map[s] = i;
+				taken[i] = 1;
+				break;
+			}
+		}
+	}
+
+	/* contacts without one go to the nearest untracked slot, closest
+	 * pair first */
+	for (;;) {
+		int64_t best = -1;
+		int bi = -1, bs = -1;
+
+		for (i = 0; i < m->nin; i++) {
+			if (taken[i] || (m->in[i].has & tid))
+				continue;
+			for (s = 0; s < MAX_SLOTS; s++) {
+				int64_t d;
+
+				if ((m->id[s] < 0) || (map[s] >= 0) ||
+				    (m->slot[s].has & tid))
+					continue;
+				d = fakeston_mtdev_dist(&m->in[i], &m->slot[s]);
+				if ((best < 0) || (d < best)) {
+					best = d;
+					bi = i;
+					bs = s;
+				}
+			}
+		}
+		if (bi < 0)
+			break;
+		map[bs] = bi;
+		taken[bi] = 1;
+	}
+
+	/* new contacts take the lowest free slots */
+	for (i = 0; i < m->nin; i++) {
+		if (taken[i])
+			continue;
+		for (s = 0; s < MAX_SLOTS; s++) {
+			if ((m->id[s] < 0) && (map[s] < 0)) {
+				map[s] = i;
+				taken[i] = 1;
+				break;
+			}
+		}
+	}
+}
+
+static void
+fakeston_mtdev_frame(struct fakeston_mtdev *m, const struct timeval *time)
+{
+	int map[MAX_SLOTS];
+	int s, k;
+
+	fakeston_mtdev_match(m, map);
+
+	for (s = 0; s < MAX_SLOTS; s++) {
+		struct fakeston_mt_contact *c;
+		uint32_t changed;
+
+		if (map[s] < 0) {
+			if (m->id[s] < 0)
+				continue;
+			fakeston_mtdev_select(m, time, s);
+			fakeston_mtdev_push(m, time, EV_ABS,
+					    ABS_MT_TRACKING_ID, -1);
+			m->id[s] = -1;
+			m->slot[s].has = 0;
+			continue;
+		}
+
+		c = &m->in[map[s]];
+		if (m->id[s] < 0) {
+			m->id[s] = m->next_id;
+			m->next_id = (m->next_id + 1) & 0xffff;
+			fakeston_mtdev_select(m, time, s);
+			fakeston_mtdev_push(m, time, EV_ABS,
+					    ABS_MT_TRACKING_ID, m->id[s]);
+			changed = c->has;
+		} else {
+			changed = 0;
+			for (k = 0; k < FAKESTON_MT_CNT; k++)
+				if ((c->has & (1u << k)) &&
+				    (!(m->slot[s].has & (1u << k)) ||
+				     (c->val[k] != m->slot[s].val[k])))
+					changed |= 1u << k;
+		}
+
+		/* the tracking id sent is ours */
+		changed &= ~FAKESTON_MT_BIT(ABS_MT_TRACKING_ID);
+		for (k = 0; k < FAKESTON_MT_CNT; k++) {
+			if (!(changed & (1u << k)))
+				continue;
+			fakeston_mtdev_select(m, time, s);
+			fakeston_mtdev_push(m, time, EV_ABS,
+					    FAKESTON_MT_FIRST + k, c->val[k]);
+		}
+
+		for (k = 0; k < FAKESTON_MT_CNT; k++)
+			if (c->has & (1u << k))
+				m->slot[s].val[k] = c->val[k];
+		m->slot[s].has |= c->has;
+	}
+}
+
+static void
+fakeston_mtdev_convert(struct fakeston_mtdev *m, const struct input_event *e)
+{
+	struct fakeston_mt_contact *c;
+
+	switch (e->type) {
+	case EV_ABS:
+		if ((e->code < FAKESTON_MT_FIRST) || (e->code > FAKESTON_MT_LAST))
+			break;
+		/* contacts past the last slot are dropped */
+		if (m->nin < MAX_SLOTS) {
+			c = &m->in[m->nin];
+			c->val[e->code - FAKESTON_MT_FIRST] = e->value;
+			c->has |= FAKESTON_MT_BIT(e->code);
+		}
+		return;
+	case EV_SYN:
+		switch (e->code) {
+		case SYN_MT_REPORT:
+			if ((m->nin < MAX_SLOTS) && m->in[m->nin].has)
+				m->nin++;
+			return;
+		case SYN_REPORT:
+			/* tolerate a last contact without SYN_MT_REPORT */
+			if ((m->nin < MAX_SLOTS) && m->in[m->nin].has)
+				m->nin++;
+			fakeston_mtdev_frame(m, &e->time);
+			memset(m->in, 0, sizeof(m->in));
+			m->nin = 0;
+			break;
+		case SYN_DROPPED:
+			memset(m->in, 0, sizeof(m->in));
+			m->nin = 0;
+			break;
+		}
+		break;
+	}
+
+	m->q[m->tail++] = *e;
+}
+
+struct mtdev *mtdev_new_open(int fd)
+{
+	struct fakeston_mtdev *m;
+	int s;
+
+	m = calloc(1, sizeof(*m));
+	if (m == NULL)
+		return NULL;
+
+	for (s = 0; s < MAX_SLOTS; s++)
+		m->id[s] = -1;
+
+	return (struct mtdev *) m;
+}
+
+int mtdev_get(struct mtdev *dev, int fd, struct input_event* ev, int ev_max)
+{
+	struct fakeston_mtdev *m = (struct fakeston_mtdev *) dev;
+	int n = 0;
+
+	while (n < ev_max) {
+		if (m->head < m->tail) {
+			ev[n++] = m->q[m->head++];
+			continue;
+		}
+		m->head = m->tail = 0;
+
+		if (m->rpos == m->rcnt) {
+			ssize_t len = read(fd, m->raw, sizeof(m->raw));
+
+			if (len <= 0)
+				return n ? n : (int) len;
+
+			m->rpos = 0;
+			m->rcnt = len / sizeof(m->raw[0]);
+		}
+
+		while ((m->rpos < m->rcnt) &&
+		       (m->tail + FAKESTON_MTDEV_FRAME <= FAKESTON_MTDEV_QUEUE))
+			fakeston_mtdev_convert(m, &m->raw[m->rpos++]);
+	}
+
+	return n;
+}
+
+void mtdev_close_delete(struct mtdev *dev)
+{
+	free(dev);
+}
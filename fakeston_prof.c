@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "fakeston_prof.h"
+#include "filter.h"
+
+__thread struct fakeston_prof *fakeston_prof_cur = NULL;
+
+/*
+ * The filter stage is timed around the filter entry points of filter.c,
+ * which build.sh links with --wrap, so that filter.c stays as upstream.
+ */
+void __real_weston_filter_dispatch(struct weston_motion_filter *filter,
+				   struct weston_motion_params *motion,
+				   void *data, uint32_t time);
+void __real_weston_filter_dispatch_batch(struct weston_motion_filter *filter,
+					 struct weston_motion_params *motion,
+					 const uint32_t *time, int count,
+					 void *data);
+
+void __wrap_weston_filter_dispatch(struct weston_motion_filter *filter,
+				   struct weston_motion_params *motion,
+				   void *data, uint32_t time)
+{
+	fakeston_prof_enter(FAKESTON_STAGE_FILTER);
+	__real_weston_filter_dispatch(filter, motion, data, time);
+	fakeston_prof_leave();
+}
+
+void __wrap_weston_filter_dispatch_batch(struct weston_motion_filter *filter,
+					 struct weston_motion_params *motion,
+					 const uint32_t *time, int count,
+					 void *data)
+{
+	fakeston_prof_enter(FAKESTON_STAGE_FILTER);
+	__real_weston_filter_dispatch_batch(filter, motion, time, count, data);
+	fakeston_prof_leave();
+}
+
+static const char *fakeston_stage_names[FAKESTON_STAGE_CNT] = {
+	[FAKESTON_STAGE_REPLAY] = "replay",
+	[FAKESTON_STAGE_PARSE] = "parse",
+	[FAKESTON_STAGE_DECODE] = "decode",
+	[FAKESTON_STAGE_TRANSPORT] = "transport",
+	[FAKESTON_STAGE_DISPATCH] = "dispatch",
+	[FAKESTON_STAGE_FILTER] = "filter",
+	[FAKESTON_STAGE_OUTPUT] = "output",
+};
+
+/* what the finished replays add up to, and the csv they write */
+static struct {
+	pthread_mutex_t lock;
+	struct fakeston_prof all;
+	FILE *csv;
+	double ns_per_tick;
+} fakeston_prof_total = {
+	PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t fakeston_prof_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t fakeston_prof_tick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return fakeston_prof_ns();
+#endif
+}
+
+/* the tsc rate against CLOCK_MONOTONIC, over a few milliseconds */
+static double fakeston_prof_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint64_t n0, t0, n1, t1;
+
+	n0 = fakeston_prof_ns();
+	t0 = fakeston_prof_tick();
+	do {
+		n1 = fakeston_prof_ns();
+	} while (n1 - n0 < 5000000);
+	t1 = fakeston_prof_tick();
+
+	return (t1 > t0) ? (double) (n1 - n0) / (t1 - t0) : 1.0;
+#else
+	return 1.0;
+#endif
+}
+
+static void fakeston_prof_charge(struct fakeston_prof *prof, uint64_t now)
+{
+	int top = prof->depth < FAKESTON_PROF_DEPTH ?
+		  prof->depth : FAKESTON_PROF_DEPTH;
+	uint64_t dt = now - prof->last;
+
+	prof->last = now;
+	if (top == 0)
+		return;
+
+	top = prof->stack[top - 1];
+	prof->ticks[top] += dt;
+	if (prof->dev) {
+		prof->dev->ticks[top] += dt;
+		prof->burst[top] += dt;
+	}
+}
+
+void fakeston_prof_push(struct fakeston_prof *prof, enum fakeston_stage stage)
+{
+	fakeston_prof_charge(prof, fakeston_prof_tick());
+
+	if (prof->depth < FAKESTON_PROF_DEPTH)
+		prof->stack[prof->depth] = stage;
+	prof->depth++;
+}
+
+void fakeston_prof_pop(struct fakeston_prof *prof)
+{
+	fakeston_prof_charge(prof, fakeston_prof_tick());
+
+	if (prof->depth > 0)
+		prof->depth--;
+}
+
+int fakeston_prof_start(const char *csv)
+{
+	int s;
+
+	fakeston_prof_total.ns_per_tick = fakeston_prof_calibrate();
+
+	if (csv == NULL)
+		return 0;
+
+	fakeston_prof_total.csv = fopen(csv, "w");
+	if (fakeston_prof_total.csv == NULL)
+		return -1;
+
+	fprintf(fakeston_prof_total.csv, "case,seq,device,interface,events");
+	for (s = 0; s < FAKESTON_STAGE_CNT; s++)
+		fprintf(fakeston_prof_total.csv, ",%s_ns", fakeston_stage_names[s]);
+	fprintf(fakeston_prof_total.csv, "\n");
+
+	return 0;
+}
+
+struct fakeston_prof *fakeston_prof_new(const char *name)
+{
+	struct fakeston_prof *prof = calloc(1, sizeof(*prof));
+
+	if (prof == NULL)
+		return NULL;
+
+	prof->name = name;
+	prof->cases = 1;
+	prof->last = fakeston_prof_tick();
+
+	return prof;
+}
+
+static struct fakeston_prof_dev *
+fakeston_prof_find(struct fakeston_prof_dev *list, const char *name,
+		   const char *iface)
+{
+	for (; list; list = list->next)
+		if ((list->iface == iface) &&
+		    (0 == strncmp(list->name, name, sizeof(list->name) - 1)))
+			return list;
+
+	return NULL;
+}
+
+struct fakeston_prof_dev *fakeston_prof_dev(struct fakeston_prof *prof,
+					    const char *name,
+					    const char *iface)
+{
+	struct fakeston_prof_dev *dev;
+
+	dev = fakeston_prof_find(prof->devs, name, iface);
+	if (dev)
+		return dev;
+
+	dev = calloc(1, sizeof(*dev));
+	if (dev == NULL)
+		return NULL;
+
+	strncpy(dev->name, name, sizeof(dev->name) - 1);
+	dev->iface = iface;
+	dev->next = prof->devs;
+	prof->devs = dev;
+
+	return dev;
+}
+
+void fakeston_prof_burst_begin(struct fakeston_prof *prof,
+			       struct fakeston_prof_dev *dev)
+{
+	/* the time so far is not the burst's */
+	fakeston_prof_charge(prof, fakeston_prof_tick());
+
+	prof->dev = dev;
+	memset(prof->burst, 0, sizeof(prof->burst));
+}
+
+void fakeston_prof_burst_end(struct fakeston_prof *prof, uint64_t seq,
+			     uintptr_t id, size_t n)
+{
+	struct fakeston_prof_dev *dev = prof->dev;
+	FILE *csv = fakeston_prof_total.csv;
+	int s;
+
+	fakeston_prof_charge(prof, fakeston_prof_tick());
+	prof->dev = NULL;
+	prof->bursts++;
+	prof->events += n;
+	if (dev == NULL)
+		return;
+
+	dev->bursts++;
+	dev->events += n;
+
+	if (csv == NULL)
+		return;
+
+	pthread_mutex_lock(&fakeston_prof_total.lock);
+	fprintf(csv, "%s,%llu,%#llx,%s,%zu", prof->name,
+		(unsigned long long) seq, (unsigned long long) id,
+		dev->iface, n);
+	for (s = 0; s < FAKESTON_STAGE_CNT; s++)
+		fprintf(csv, ",%.0f",
+			prof->burst[s] * fakeston_prof_total.ns_per_tick);
+	fprintf(csv, "\n");
+	pthread_mutex_unlock(&fakeston_prof_total.lock);
+}
+
+/* adds a finished replay to the totals and frees it */
+void fakeston_prof_done(struct fakeston_prof *prof)
+{
+	struct fakeston_prof *all = &fakeston_prof_total.all;
+	struct fakeston_prof_dev *dev, *next, *to;
+	int s;
+
+	fakeston_prof_charge(prof, fakeston_prof_tick());
+
+	pthread_mutex_lock(&fakeston_prof_total.lock);
+	for (s = 0; s < FAKESTON_STAGE_CNT; s++)
+		all->ticks[s] += prof->ticks[s];
+	all->cases += prof->cases;
+	all->bursts += prof->bursts;
+	all->events += prof->events;
+
+	for (dev = prof->devs; dev; dev = next) {
+		next = dev->next;
+
+		to = fakeston_prof_find(all->devs, dev->name, dev->iface);
+		if (to == NULL) {
+			dev->next = all->devs;
+			all->devs = dev;
+			continue;
+		}
+
+		to->bursts += dev->bursts;
+		to->events += dev->events;
+		for (s = 0; s < FAKESTON_STAGE_CNT; s++)
+			to->ticks[s] += dev->ticks[s];
+		free(dev);
+	}
+	pthread_mutex_unlock(&fakeston_prof_total.lock);
+
+	free(prof);
+}
+
+static double fakeston_prof_ms(uint64_t ticks)
+{
+	return ticks * fakeston_prof_total.ns_per_tick / 1e6;
+}
+
+static double fakeston_prof_per_event(uint64_t ticks, uint64_t events)
+{
+	return events ? ticks * fakeston_prof_total.ns_per_tick / events : 0;
+}
+
+void fakeston_prof_report(FILE *out)
+{
+	struct fakeston_prof *all = &fakeston_prof_total.all;
+	struct fakeston_prof_dev *dev, *next;
+	const char *ifaces[16];
+	uint64_t sum = 0;
+	int s, i, n = 0;
+
+	for (s = 0; s < FAKESTON_STAGE_CNT; s++)
+		sum += all->ticks[s];
+
+	fprintf(out, "FAKESTON: PROFILE %llu cases, %llu bursts, %llu events, "
+		"%.3f ms\n", (unsigned long long) all->cases,
+		(unsigned long long) all->bursts,
+		(unsigned long long) all->events, fakeston_prof_ms(sum));
+
+	fprintf(out, "%-12s %12s %7s %12s\n", "stage", "ms", "%", "ns/event");
+	for (s = 0; s < FAKESTON_STAGE_CNT; s++)
+		fprintf(out, "%-12s %12.3f %7.2f %12.1f\n",
+			fakeston_stage_names[s], fakeston_prof_ms(all->ticks[s]),
+			sum ? 100.0 * all->ticks[s] / sum : 0,
+			fakeston_prof_per_event(all->ticks[s], all->events));
+
+	/* dispatch interfaces, then the devices using them */
+	for (dev = all->devs; dev; dev = dev->next) {
+		for (i = 0; i < n; i++)
+			if (ifaces[i] == dev->iface)
+				break;
+		if ((i == n) && (n < 16))
+			ifaces[n++] = dev->iface;
+	}
+
+	fprintf(out, "\n%-40s %9s %10s %12s %12s\n", "interface / device",
+		"bursts", "events", "ms", "ns/event");
+	for (i = 0; i < n; i++) {
+		uint64_t bursts = 0, events = 0, ticks = 0;
+
+		for (dev = all->devs; dev; dev = dev->next) {
+			if (dev->iface != ifaces[i])
+				continue;
+			bursts += dev->bursts;
+			events += dev->events;
+			for (s = 0; s < FAKESTON_STAGE_CNT; s++)
+				ticks += dev->ticks[s];
+		}
+		fprintf(out, "%-40s %9llu %10llu %12.3f %12.1f\n", ifaces[i],
+			(unsigned long long) bursts,
+			(unsigned long long) events, fakeston_prof_ms(ticks),
+			fakeston_prof_per_event(ticks, events));
+
+		for (dev = all->devs; dev; dev = dev->next) {
+			if (dev->iface != ifaces[i])
+				continue;
+			ticks = 0;
+			for (s = 0; s < FAKESTON_STAGE_CNT; s++)
+				ticks += dev->ticks[s];
+			fprintf(out, "  %-38.38s %9llu %10llu %12.3f %12.1f\n",
+				dev->name, (unsigned long long) dev->bursts,
+				(unsigned long long) dev->events,
+				fakeston_prof_ms(ticks),
+				fakeston_prof_per_event(ticks, dev->events));
+		}
+	}
+
+	for (dev = all->devs; dev; dev = next) {
+		next = dev->next;
+		free(dev);
+	}
+	all->devs = NULL;
+
+	if (fakeston_prof_total.csv) {
+		fclose(fakeston_prof_total.csv);
+		fakeston_prof_total.csv = NULL;
+	}
+}
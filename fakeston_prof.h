@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FAKESTON_PROF_H_
+#define _FAKESTON_PROF_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Stage profiler. Each replay thread keeps a stack of the stages it is in
+ * and charges the time since the last change to the innermost one, so a
+ * stage's time excludes the stages nested in it. With no profiler set on
+ * the thread every hook is a single branch.
+ */
+
+enum fakeston_stage {
+	FAKESTON_STAGE_REPLAY,		/* device setup, timers, bookkeeping */
+	FAKESTON_STAGE_PARSE,		/* ftestcase lines */
+	FAKESTON_STAGE_DECODE,		/* evemu event text */
+	FAKESTON_STAGE_TRANSPORT,	/* pipe write, read() of the device */
+	FAKESTON_STAGE_DISPATCH,	/* evdev.c and the dispatch interface */
+	FAKESTON_STAGE_FILTER,		/* pointer acceleration */
+	FAKESTON_STAGE_OUTPUT,		/* notify_*, weston_log and the sink */
+	FAKESTON_STAGE_CNT
+};
+
+#define FAKESTON_PROF_DEPTH 16
+
+/* totals of the devices sharing a name and a dispatch interface */
+struct fakeston_prof_dev {
+	struct fakeston_prof_dev *next;
+	char name[80];
+	const char *iface;
+	uint64_t bursts, events;
+	uint64_t ticks[FAKESTON_STAGE_CNT];
+};
+
+struct fakeston_prof {
+	const char *name;	/* test case, for the csv */
+	uint64_t last;
+	int depth;
+	uint8_t stack[FAKESTON_PROF_DEPTH];
+	uint64_t ticks[FAKESTON_STAGE_CNT];
+	uint64_t cases, bursts, events;
+	struct fakeston_prof_dev *dev;	/* device of the burst replayed */
+	uint64_t burst[FAKESTON_STAGE_CNT];	/* time of that burst */
+	struct fakeston_prof_dev *devs;
+};
+
+extern __thread struct fakeston_prof *fakeston_prof_cur;
+
+void fakeston_prof_push(struct fakeston_prof *prof, enum fakeston_stage stage);
+void fakeston_prof_pop(struct fakeston_prof *prof);
+
+static inline void fakeston_prof_enter(enum fakeston_stage stage)
+{
+	if (fakeston_prof_cur)
+		fakeston_prof_push(fakeston_prof_cur, stage);
+}
+
+static inline void fakeston_prof_leave(void)
+{
+	if (fakeston_prof_cur)
+		fakeston_prof_pop(fakeston_prof_cur);
+}
+
+int fakeston_prof_start(const char *csv);
+struct fakeston_prof *fakeston_prof_new(const char *name);
+struct fakeston_prof_dev *fakeston_prof_dev(struct fakeston_prof *prof,
+					    const char *name,
+					    const char *iface);
+void fakeston_prof_burst_begin(struct fakeston_prof *prof,
+			       struct fakeston_prof_dev *dev);
+void fakeston_prof_burst_end(struct fakeston_prof *prof, uint64_t seq,
+			     uintptr_t id, size_t n);
+void fakeston_prof_done(struct fakeston_prof *prof);
+void fakeston_prof_report(FILE *out);
+
+#endif
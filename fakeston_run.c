@@ -16,185 +16,110 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/stat.h>
 #include "fakeston.h"
-#include "evdev.h"
 
-
-int
-weston_log(const char *fmt, ...)
-{
-	int l;
-	va_list argp;
-	va_start(argp, fmt);
-	l = vfprintf(stdout, fmt, argp);
-	va_end(argp);
-	return l;
-}
-
-void
-notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
-	      enum wl_pointer_button_state state)
-{
-
-	fprintf(stdout, "notify_button\t%p\t%11u %11i %11u\n",
-		seat, time, button, state);
-
-}
-
-void
-notify_axis(struct weston_seat *seat, uint32_t time, uint32_t axis,
-	    wl_fixed_t value)
-{
-
-	fprintf(stdout, "notify_axis\t%p\t%11u %11u %11u\n",
-		seat, time, axis, value);
-
-}
-
-void
-notify_modifiers(struct weston_seat *seat, uint32_t serial)
-{
-
-	fprintf(stdout, "notify_modifiers\t%p\t%11u\n", seat, serial);
-
-}
-
-void
-notify_motion(struct weston_seat *seat,
-	      uint32_t time, wl_fixed_t dx, wl_fixed_t dy)
-{
-/*
-	verbose
-*/
-/*
-	fprintf(stdout, "notify_motion\t%p\t%11u %11i %11i\n",
-		seat, time, dx, dy);
-*/
-}
-
-void
-notify_motion_absolute(struct weston_seat *seat, uint32_t time,
-		       wl_fixed_t x, wl_fixed_t y)
-{
-/*
-	verbose
-*/
-
-	fprintf(stdout, "notify_motion_absolute\t%p\t%11u %11i %11i\n",
-		seat, time, x, y);
-
-}
-
-void
-notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
-	   enum wl_keyboard_key_state state,
-	   enum weston_key_state_update update_state)
-{
-
-	fprintf(stdout, "notify_key\t%p\t%11u %11u %11u %11u\n",
-		seat, time, key, state, update_state);
-
-}
-
-void
-notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
-             wl_fixed_t x, wl_fixed_t y, int touch_type)
-{
-	/* verbose */
-
-	fprintf(stdout, "notify_touch\t%p\t%11u %11i %11u %11u %11i\n",
-		seat, time, touch_id, x, y, touch_type);
-
-}
-
-void
-weston_seat_init_pointer(struct weston_seat *seat)
-{
-
-}
-
-int
-weston_seat_init_keyboard(struct weston_seat *seat, struct xkb_keymap *keymap)
-{
-	return 0;
-}
-
-void
-weston_seat_init_touch(struct weston_seat *seat)
-{
-
-}
-
-struct mtdev *mtdev_new_open(int fd)
-{
-	return NULL;
-}
-
-int mtdev_get(struct mtdev *dev, int fd, struct input_event* ev, int ev_max)
-{
-	return 0;
-}
-
-void mtdev_close_delete(struct mtdev *dev)
-{
-
-}
-
-struct wl_event_loop *wl_display_get_event_loop(struct wl_display *display)
-{
-	return NULL;
-}
-struct wl_event_source *wl_event_loop_add_timer(struct wl_event_loop *loop,
-						wl_event_loop_timer_func_t func,
-						void *data)
-{
-	return NULL;
-}
-
-int wl_event_source_remove(struct wl_event_source *source)
-{
-	free(source);
-	return 0;
-}
-
-struct wl_event_source *wl_event_loop_add_fd(struct wl_event_loop *loop,
-					     int fd, uint32_t mask,
-					     wl_event_loop_fd_func_t func,
-					     void *data)
+int main(int argc, char**argv)
 {
-	struct wl_event_source_fd *new;
-	new = malloc(sizeof(struct wl_event_source_fd));
+	static const struct option opts[] = {
+		{ "compile", required_argument, NULL, 'c' },
+		{ "pipe", no_argument, NULL, 'p' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "speed", required_argument, NULL, 's' },
+		{ "binary", no_argument, NULL, 'b' },
+		{ "expect", required_argument, NULL, 'e' },
+		{ "profile", optional_argument, NULL, 'P' },
+		{ "accel", required_argument, NULL, 'a' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct fakeston_config cfg;
+	char *compile = NULL, *profile_csv = NULL, *end;
+	int c, jobs = 0, ret;
+	struct stat st;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.feed = FAKESTON_FEED_MEMORY;
+	cfg.output = FAKESTON_OUTPUT_TEXT;
+
+	while ((c = getopt_long(argc, argv, "c:pj:be:s:P::a:", opts, NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			compile = optarg;
+			break;
+		case 'p':
+			cfg.feed = FAKESTON_FEED_PIPE;
+			break;
+		case 'b':
+			cfg.output = FAKESTON_OUTPUT_BINARY;
+			break;
+		case 'e':
+			cfg.expect = optarg;
+			break;
+		case 'P':
+			cfg.profile = 1;
+			profile_csv = optarg;
+			break;
+		case 'a':
+			if (fakeston_accel_add(optarg) < 0) {
+				fprintf(stderr, "Error: bad acceleration "
+					"profile '%s'\n", optarg);
+				usage();
+				return -1;
+			}
+			break;
+		case 's':
+			cfg.speed = strtod(optarg, &end);
+			if ((end == optarg) || (*end != '\0') ||
+			    !(cfg.speed >= 0)) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs < 1) {
+				usage();
+				return -1;
+			}
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
 
-	new->func = func;
+	if (optind >= argc) {
+		usage();
+		return -1;
+	}
 
-	return (struct wl_event_source *) new;
-}
-int wl_event_source_timer_update(struct wl_event_source *source,
-				 int ms_delay)
-{
-	return 0;
-}
+	if (compile)
+		return fakeston_compile(argv[optind], compile);
 
-uint32_t
-weston_compositor_get_time(void)
-{
-	return 0;
-}
+	if (cfg.profile && (fakeston_prof_start(profile_csv) < 0)) {
+		fprintf(stderr, "Error: cannot write '%s'\n", profile_csv);
+		return -1;
+	}
 
-void
-notify_keyboard_focus_in(struct weston_seat *seat, struct wl_array *keys,
-			 enum weston_key_state_update update_state)
-{
+	if (jobs || (optind + 1 < argc) ||
+	    ((stat(argv[optind], &st) == 0) && S_ISDIR(st.st_mode))) {
+		if (cfg.expect) {
+			fprintf(stderr, "Error: --expect takes a single test case\n");
+			return -1;
+		}
+		ret = fakeston_batch(argv + optind, argc - optind, &cfg,
+				     jobs ? jobs : 1);
+	} else {
+		ret = fakeston_main(argv[optind], &cfg, stdout);
+	}
 
-}
+	if (cfg.profile)
+		fakeston_prof_report(stderr);
 
-int main(int argc, char**argv)
-{
-	if (argc < 2) {
-		usage();
-		return -1;
-	}
+	fakeston_accel_clear();
 
-	return fakeston_main(argv[1]);
+	return ret;
 }
 
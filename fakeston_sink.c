@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "compositor.h"
+#include "fakeston.h"
+
+/* the classic notify_* log lines */
+struct fakeston_sink_text {
+	struct fakeston_sink base;
+	FILE *out;
+};
+
+static void
+text_notify(struct fakeston_sink *sink, void *seat,
+	    const struct fakeston_notify_rec *n)
+{
+	FILE *out = ((struct fakeston_sink_text *) sink)->out;
+	const int32_t *a = n->arg;
+
+	switch (n->type) {
+	case FAKESTON_NOTIFY_BUTTON:
+		fprintf(out, "notify_button\t%p\t%11u %11i %11u\n",
+			seat, n->time, a[0], a[1]);
+		break;
+	case FAKESTON_NOTIFY_AXIS:
+		fprintf(out, "notify_axis\t%p\t%11u %11u %11u\n",
+			seat, n->time, a[0], a[1]);
+		break;
+	case FAKESTON_NOTIFY_MODIFIERS:
+		fprintf(out, "notify_modifiers\t%p\t%11u\n", seat, a[0]);
+		break;
+	case FAKESTON_NOTIFY_MOTION:
+		/* verbose */
+		break;
+	case FAKESTON_NOTIFY_MOTION_ABSOLUTE:
+		fprintf(out, "notify_motion_absolute\t%p\t%11u %11i %11i\n",
+			seat, n->time, a[0], a[1]);
+		break;
+	case FAKESTON_NOTIFY_KEY:
+		fprintf(out, "notify_key\t%p\t%11u %11u %11u %11u\n",
+			seat, n->time, a[0], a[1], a[2]);
+		break;
+	case FAKESTON_NOTIFY_TOUCH:
+		fprintf(out, "notify_touch\t%p\t%11u %11i %11u %11u %11i\n",
+			seat, n->time, a[0], a[1], a[2], a[3]);
+		break;
+	case FAKESTON_NOTIFY_GESTURE:
+		fprintf(out, "notify_gesture\t%p\t%11u %11u %11u %11i %11i %11i\n",
+			seat, n->time, a[0] & 0xffff, (uint32_t) a[0] >> 16,
+			a[1], a[2], a[3]);
+		break;
+	}
+}
+
+static void
+text_log(struct fakeston_sink *sink, const char *fmt, va_list ap)
+{
+	vfprintf(((struct fakeston_sink_text *) sink)->out, fmt, ap);
+}
+
+static int
+text_flush(struct fakeston_sink *sink)
+{
+	return fflush(((struct fakeston_sink_text *) sink)->out);
+}
+
+static void
+text_destroy(struct fakeston_sink *sink)
+{
+	text_flush(sink);
+	free(sink);
+}
+
+static const struct fakeston_sink_interface text_interface = {
+	text_notify,
+	text_log,
+	NULL,
+	text_flush,
+	text_destroy
+};
+
+struct fakeston_sink *
+fakeston_sink_text_create(FILE *out)
+{
+	struct fakeston_sink_text *sink;
+
+	sink = malloc(sizeof *sink);
+	if (sink == NULL)
+		return NULL;
+
+	sink->base.interface = &text_interface;
+	sink->out = out;
+
+	return &sink->base;
+}
+
+/*
+ * Fixed-size fakeston_notify_rec records, buffered and written with one
+ * writev together with the stream header on the first flush. Messages go
+ * to stderr so they never end up inside the record stream.
+ */
+#define FAKESTON_SINK_RECS 32768
+
+struct fakeston_sink_binary {
+	struct fakeston_sink base;
+	int fd;
+	int headed;
+	int failed;
+	size_t cnt;
+	struct fakeston_notify_rec rec[FAKESTON_SINK_RECS];
+};
+
+static int
+binary_flush(struct fakeston_sink *sink)
+{
+	struct fakeston_sink_binary *b = (struct fakeston_sink_binary *) sink;
+	struct fakeston_notify_header hdr;
+	struct iovec iov[2], *v = iov;
+	int cnt = 0;
+	ssize_t n;
+
+	if (!b->headed) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, FAKESTON_NOTIFY_MAGIC, sizeof(hdr.magic));
+		hdr.format = FAKESTON_NOTIFY_FORMAT;
+		hdr.rec_size = sizeof(struct fakeston_notify_rec);
+		iov[cnt].iov_base = &hdr;
+		iov[cnt++].iov_len = sizeof(hdr);
+		b->headed = 1;
+	}
+	if (b->cnt) {
+		iov[cnt].iov_base = b->rec;
+		iov[cnt++].iov_len = b->cnt * sizeof(b->rec[0]);
+	}
+	b->cnt = 0;
+
+	while (cnt) {
+		n = writev(b->fd, v, cnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			b->failed = 1;
+			return -1;
+		}
+
+		/* short write, move on to what is left */
+		while (cnt && ((size_t) n >= v->iov_len)) {
+			n -= v->iov_len;
+			v++;
+			cnt--;
+		}
+		if (cnt) {
+			v->iov_base = (char *) v->iov_base + n;
+			v->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+static void
+binary_notify(struct fakeston_sink *sink, void *seat,
+	      const struct fakeston_notify_rec *n)
+{
+	struct fakeston_sink_binary *b = (struct fakeston_sink_binary *) sink;
+
+	if (b->cnt == FAKESTON_SINK_RECS)
+		binary_flush(sink);
+
+	b->rec[b->cnt++] = *n;
+}
+
+static void
+binary_log(struct fakeston_sink *sink, const char *fmt, va_list ap)
+{
+	vfprintf(stderr, fmt, ap);
+}
+
+static int
+binary_finish(struct fakeston_sink *sink)
+{
+	binary_flush(sink);
+
+	return ((struct fakeston_sink_binary *) sink)->failed ? -1 : 0;
+}
+
+static void
+binary_destroy(struct fakeston_sink *sink)
+{
+	binary_flush(sink);
+	free(sink);
+}
+
+static const struct fakeston_sink_interface binary_interface = {
+	binary_notify,
+	binary_log,
+	NULL,
+	binary_finish,
+	binary_destroy
+};
+
+struct fakeston_sink *
+fakeston_sink_binary_create(int fd)
+{
+	struct fakeston_sink_binary *sink;
+
+	sink = malloc(sizeof *sink);
+	if (sink == NULL)
+		return NULL;
+
+	sink->base.interface = &binary_interface;
+	sink->fd = fd;
+	sink->headed = 0;
+	sink->failed = 0;
+	sink->cnt = 0;
+
+	return &sink->base;
+}
+
+/*
+ * Compares the notify stream with a golden binary stream as it is produced
+ * and raises *stop at the first difference, so a failing replay ends there
+ * and nothing is kept in memory but one buffered read of the golden file.
+ */
+struct fakeston_sink_expect {
+	struct fakeston_sink base;
+	FILE *golden;
+	const char *path;
+	int *stop;
+	int failed;
+	uint64_t nrec;		/* records matched so far */
+	uint64_t seq, dev;	/* burst being replayed */
+	int in_burst;
+};
+
+static const char *fakeston_notify_names[] = {
+	[FAKESTON_NOTIFY_BUTTON] = "notify_button",
+	[FAKESTON_NOTIFY_AXIS] = "notify_axis",
+	[FAKESTON_NOTIFY_MODIFIERS] = "notify_modifiers",
+	[FAKESTON_NOTIFY_MOTION] = "notify_motion",
+	[FAKESTON_NOTIFY_MOTION_ABSOLUTE] = "notify_motion_absolute",
+	[FAKESTON_NOTIFY_KEY] = "notify_key",
+	[FAKESTON_NOTIFY_TOUCH] = "notify_touch",
+	[FAKESTON_NOTIFY_GESTURE] = "notify_gesture",
+};
+
+static void
+expect_print(const char *what, const struct fakeston_notify_rec *n)
+{
+	const char *name = "unknown";
+
+	if (n == NULL) {
+		fprintf(stderr, "  %s: nothing\n", what);
+		return;
+	}
+
+	if ((n->type < sizeof(fakeston_notify_names) /
+		       sizeof(fakeston_notify_names[0])) &&
+	    fakeston_notify_names[n->type])
+		name = fakeston_notify_names[n->type];
+
+	fprintf(stderr, "  %s: %s seat 0x%llx time %u args %i %i %i %i\n",
+		what, name, (unsigned long long) n->seat, n->time,
+		n->arg[0], n->arg[1], n->arg[2], n->arg[3]);
+}
+
+static void
+expect_diverged(struct fakeston_sink_expect *e,
+		const struct fakeston_notify_rec *want,
+		const struct fakeston_notify_rec *got)
+{
+	fprintf(stderr, "FAKESTON: DIVERGED from %s at record %llu",
+		e->path, (unsigned long long) e->nrec);
+	if (e->in_burst)
+		fprintf(stderr, ", burst %llu of device 0x%llx",
+			(unsigned long long) e->seq,
+			(unsigned long long) e->dev);
+	fprintf(stderr, "\n");
+	expect_print("expected", want);
+	expect_print("replayed", got);
+
+	e->failed = 1;
+	*e->stop = 1;
+}
+
+static void
+expect_notify(struct fakeston_sink *sink, void *seat,
+	      const struct fakeston_notify_rec *n)
+{
+	struct fakeston_sink_expect *e = (struct fakeston_sink_expect *) sink;
+	struct fakeston_notify_rec want;
+
+	if (e->failed)
+		return;
+
+	if (fread(&want, sizeof(want), 1, e->golden) != 1) {
+		expect_diverged(e, NULL, n);
+		return;
+	}
+
+	if (memcmp(&want, n, sizeof(want)) != 0) {
+		expect_diverged(e, &want, n);
+		return;
+	}
+
+	e->nrec++;
+}
+
+static void
+expect_log(struct fakeston_sink *sink, const char *fmt, va_list ap)
+{
+	vfprintf(stderr, fmt, ap);
+}
+
+static void
+expect_burst(struct fakeston_sink *sink, uint64_t seq, uint64_t dev)
+{
+	struct fakeston_sink_expect *e = (struct fakeston_sink_expect *) sink;
+
+	e->seq = seq;
+	e->dev = dev;
+	e->in_burst = 1;
+}
+
+static int
+expect_finish(struct fakeston_sink *sink)
+{
+	struct fakeston_sink_expect *e = (struct fakeston_sink_expect *) sink;
+	struct fakeston_notify_rec want;
+
+	if (e->failed)
+		return -1;
+
+	/* the replay is over, the golden stream must be too */
+	e->in_burst = 0;
+	if (fread(&want, sizeof(want), 1, e->golden) == 1) {
+		expect_diverged(e, &want, NULL);
+		return -1;
+	}
+
+	fprintf(stderr, "FAKESTON: MATCHED %s, %llu records\n",
+		e->path, (unsigned long long) e->nrec);
+
+	return 0;
+}
+
+static void
+expect_destroy(struct fakeston_sink *sink)
+{
+	struct fakeston_sink_expect *e = (struct fakeston_sink_expect *) sink;
+
+	fclose(e->golden);
+	free(e);
+}
+
+static const struct fakeston_sink_interface expect_interface = {
+	expect_notify,
+	expect_log,
+	expect_burst,
+	expect_finish,
+	expect_destroy
+};
+
+struct fakeston_sink *
+fakeston_sink_expect_create(const char *golden, int *stop)
+{
+	struct fakeston_sink_expect *sink;
+	struct fakeston_notify_header hdr;
+
+	sink = calloc(1, sizeof *sink);
+	if (sink == NULL)
+		return NULL;
+
+	sink->golden = fopen(golden, "rb");
+	if (sink->golden == NULL) {
+		fprintf(stderr, "Error: cannot open golden file '%s'\n", golden);
+		free(sink);
+		return NULL;
+	}
+	setvbuf(sink->golden, NULL, _IOFBF, 1 << 20);
+
+	if ((fread(&hdr, sizeof(hdr), 1, sink->golden) != 1) ||
+	    (memcmp(hdr.magic, FAKESTON_NOTIFY_MAGIC, sizeof(hdr.magic)) != 0) ||
+	    (hdr.format != FAKESTON_NOTIFY_FORMAT) ||
+	    (hdr.rec_size != sizeof(struct fakeston_notify_rec))) {
+		fprintf(stderr, "Error: bad golden file '%s'\n", golden);
+		fclose(sink->golden);
+		free(sink);
+		return NULL;
+	}
+
+	sink->base.interface = &expect_interface;
+	sink->path = golden;
+	sink->stop = stop;
+
+	return &sink->base;
+}
+
+void
+fakeston_sink_log(struct fakeston_sink *sink, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	sink->interface->log(sink, fmt, ap);
+	va_end(ap);
+}
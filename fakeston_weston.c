@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2013 Martin Minarik <minarik11@student.fiit.stuba.sk>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fakeston.h"
+
+/*
+ * The weston side of evdev.c: notify_* calls go to the sink of the replay,
+ * weston_log to its log.
+ */
+
+int
+weston_log(const char *fmt, ...)
+{
+	int l;
+	va_list argp;
+	va_start(argp, fmt);
+	l = fakeston_vlog(fmt, argp);
+	va_end(argp);
+	return l;
+}
+
+void
+notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
+	      enum wl_pointer_button_state state)
+{
+	struct fakeston_notify_rec n = {
+		FAKESTON_NOTIFY_BUTTON, time, 0, { button, state }
+	};
+
+	fakeston_notify(seat, &n);
+}
+
+void
+notify_axis(struct weston_seat *seat, uint32_t time, uint32_t axis,
+	    wl_fixed_t value)
+{
+	struct fakeston_notify_rec n = {
+		FAKESTON_NOTIFY_AXIS, time, 0, { axis, value }
+	};
+
+	fakeston_notify(seat, &n);
+}
+
+void
+notify_modifiers(struct weston_seat *seat, uint32_t serial)
+{
+	struct fakeston_notify_rec n = {
+		FAKESTON_NOTIFY_MODIFIERS, 0, 0, { serial }
+	};
+
+	fakeston_notify(seat, &n);
+}
+
+void
+notify_motion(struct weston_seat *seat,
+	      uint32_t time, wl_fixed_t dx, wl_fixed_t dy)
+{
+	struct fakeston_notify_rec n = {
+		FAKESTON_NOTIFY_MOTION, time, 0, { dx, dy }
+	};
+
+	fakeston_notify(seat, &n);
+}
+
+void
+notify_motion_absolute(struct weston_seat *seat, uint32_t time,
+		       wl_fixed_t x, wl_fixed_t y)
+{
+	struct fakeston_notify_rec n = {
+		FAKESTON_NOTIFY_MOTION_ABSOLUTE, time, 0, { x, y }
+	};
+
+	fakeston_notify(seat, &n);
+}
+
+void
+notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
+	   enum wl_keyboard_key_state state,
+	   enum weston_key_state_update update_state)
+{
+	struct fakeston_notify_rec n = {
+		FAKESTON_NOTIFY_KEY, time, 0, { key, state, update_state }
+	};
+
+	fakeston_notify(seat, &n);
+}
+
+void
+notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
+             wl_fixed_t x, wl_fixed_t y, int touch_type)
+{
+	struct fakeston_notify_rec n = {
+		FAKESTON_NOTIFY_TOUCH, time, 0, { touch_id, x, y, touch_type }
+	};
+
+	fakeston_notify(seat, &n);
+}
+
+void
+notify_gesture(struct weston_seat *seat, uint32_t time,
+	       enum weston_gesture gesture, enum weston_gesture_state state,
+	       wl_fixed_t dx, wl_fixed_t dy, wl_fixed_t scale)
+{
+	struct fakeston_notify_rec n = {
+		FAKESTON_NOTIFY_GESTURE, time, 0,
+		{ gesture | state << 16, dx, dy, scale }
+	};
+
+	fakeston_notify(seat, &n);
+}
+
+void
+weston_seat_init_pointer(struct weston_seat *seat)
+{
+
+}
+
+int
+weston_seat_init_keyboard(struct weston_seat *seat, struct xkb_keymap *keymap)
+{
+	return 0;
+}
+
+void
+weston_seat_init_touch(struct weston_seat *seat)
+{
+
+}
+
+void
+notify_keyboard_focus_in(struct weston_seat *seat, struct wl_array *keys,
+			 enum weston_key_state_update update_state)
+{
+
+}
@@ -21,9 +21,13 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <limits.h>
 #include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include <wayland-util.h>
 
@@ -38,6 +42,23 @@ weston_filter_dispatch(struct weston_motion_filter *filter,
 	filter->interface->filter(filter, motion, data, time);
 }
 
+void
+weston_filter_dispatch_batch(struct weston_motion_filter *filter,
+			     struct weston_motion_params *motion,
+			     const uint32_t *time, int count, void *data)
+{
+	int i;
+
+	if (filter->interface->filter_batch) {
+		filter->interface->filter_batch(filter, motion, time, count,
+						data);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		filter->interface->filter(filter, &motion[i], data, time[i]);
+}
+
 /*
  * Pointer acceleration filter
  */
@@ -46,11 +67,13 @@ weston_filter_dispatch(struct weston_motion_filter *filter,
 #define MOTION_TIMEOUT		300 /* (ms) */
 #define NUM_POINTER_TRACKERS	16
 
-struct pointer_tracker {
-	double dx;
-	double dy;
-	uint32_t time;
-	int dir;
+/* The tracker ring, one array per field so the batch path can work on
+ * all trackers at once. */
+struct pointer_trackers {
+	double dx[NUM_POINTER_TRACKERS];
+	double dy[NUM_POINTER_TRACKERS];
+	uint32_t time[NUM_POINTER_TRACKERS];
+	int dir[NUM_POINTER_TRACKERS];
 };
 
 struct pointer_accelerator;
@@ -58,13 +81,15 @@ struct pointer_accelerator {
 	struct weston_motion_filter base;
 
 	accel_profile_func_t profile;
+	/* parameters of a profile from weston_accel_profile_create() */
+	const struct weston_accel_profile *params;
 
 	double velocity;
 	double last_velocity;
 	int last_dx;
 	int last_dy;
 
-	struct pointer_tracker *trackers;
+	struct pointer_trackers *trackers;
 	int cur_tracker;
 };
 
@@ -80,12 +105,22 @@ enum directions {
 	UNDEFINED_DIRECTION = 0xff
 };
 
+/*
+ * A direction marks the octants within 0.9 octant of it, one or two. Off
+ * an axis by less than 4.5 degrees it is the axis alone, by 40.5 to 49.5
+ * the diagonal alone, the two of them in between. The slopes of those
+ * angles in 32.32 fixed point give the masks the atan2 classification
+ * gave for |dx|, |dy| below 2^18 (fakeston_bench -d checks a range).
+ */
+#define DIRECTION_TAN_4_5	338021257ULL
+#define DIRECTION_TAN_40_5	3668248612ULL
+
 static int
 get_direction(int dx, int dy)
 {
 	int dir = UNDEFINED_DIRECTION;
-	int d1, d2;
-	double r;
+	uint64_t x, y;
+	int axis_x, axis_y, diagonal;
 
 	if (abs(dx) < 2 && abs(dy) < 2) {
 		if (dx > 0 && dy > 0)
@@ -106,91 +141,134 @@ get_direction(int dx, int dy)
 			dir = NE | N | NW;
 	}
 	else {
-		/* Calculate r within the interval  [0 to 8)
-		 *
-		 * r = [0 .. 2π] where 0 is North
-		 * d_f = r / 2π  ([0 .. 1))
-		 * d_8 = 8 * d_f
-		 */
-		r = atan2(dy, dx);
-		r = fmod(r + 2.5*M_PI, 2*M_PI);
-		r *= 4*M_1_PI;
-
-		/* Mark one or two close enough octants */
-		d1 = (int)(r + 0.9) % 8;
-		d2 = (int)(r + 0.1) % 8;
-
-		dir = (1 << d1) | (1 << d2);
+		x = dx < 0 ? -(int64_t)dx : dx;
+		y = dy < 0 ? -(int64_t)dy : dy;
+
+		axis_x = dx < 0 ? W : E;
+		axis_y = dy < 0 ? N : S;
+		if (dx < 0)
+			diagonal = dy < 0 ? NW : SW;
+		else
+			diagonal = dy < 0 ? NE : SE;
+
+		/* y/x against the slopes, x < 2^31 keeps them in 64 bits */
+		if ((y << 32) < x * DIRECTION_TAN_4_5)
+			dir = axis_x;
+		else if ((y << 32) < x * DIRECTION_TAN_40_5)
+			dir = axis_x | diagonal;
+		else if ((x << 32) > y * DIRECTION_TAN_40_5)
+			dir = diagonal;
+		else if ((x << 32) > y * DIRECTION_TAN_4_5)
+			dir = diagonal | axis_y;
+		else
+			dir = axis_y;
 	}
 
 	return dir;
 }
 
 static void
-feed_trackers(struct pointer_accelerator *accel,
-	      double dx, double dy,
-	      uint32_t time)
+advance_tracker(struct pointer_accelerator *accel,
+		double dx, double dy,
+		uint32_t time)
 {
-	int i, current;
-	struct pointer_tracker *trackers = accel->trackers;
-
-	for (i = 0; i < NUM_POINTER_TRACKERS; i++) {
-		trackers[i].dx += dx;
-		trackers[i].dy += dy;
-	}
+	struct pointer_trackers *trackers = accel->trackers;
+	int current;
 
 	current = (accel->cur_tracker + 1) % NUM_POINTER_TRACKERS;
 	accel->cur_tracker = current;
 
-	trackers[current].dx = 0.0;
-	trackers[current].dy = 0.0;
-	trackers[current].time = time;
-	trackers[current].dir = get_direction(dx, dy);
+	trackers->dx[current] = 0.0;
+	trackers->dy[current] = 0.0;
+	trackers->time[current] = time;
+	trackers->dir[current] = get_direction(dx, dy);
+}
+
+static void
+accumulate_trackers(struct pointer_trackers *trackers, double dx, double dy)
+{
+	int i;
+
+	for (i = 0; i < NUM_POINTER_TRACKERS; i++) {
+		trackers->dx[i] += dx;
+		trackers->dy[i] += dy;
+	}
 }
 
-static struct pointer_tracker *
+static void
+feed_trackers(struct pointer_accelerator *accel,
+	      double dx, double dy,
+	      uint32_t time)
+{
+	accumulate_trackers(accel->trackers, dx, dy);
+	advance_tracker(accel, dx, dy, time);
+}
+
+static unsigned int
 tracker_by_offset(struct pointer_accelerator *accel, unsigned int offset)
 {
-	unsigned int index =
-		(accel->cur_tracker + NUM_POINTER_TRACKERS - offset)
+	return (accel->cur_tracker + NUM_POINTER_TRACKERS - offset)
 		% NUM_POINTER_TRACKERS;
-	return &accel->trackers[index];
 }
 
 static double
-calculate_tracker_velocity(struct pointer_tracker *tracker, uint32_t time)
+calculate_tracker_velocity(struct pointer_trackers *trackers,
+			   unsigned int index, uint32_t time)
 {
 	int dx;
 	int dy;
 	double distance;
 
-	dx = tracker->dx;
-	dy = tracker->dy;
+	dx = trackers->dx[index];
+	dy = trackers->dy[index];
 	distance = sqrt(dx*dx + dy*dy);
-	return distance / (double)(time - tracker->time);
+	return distance / (double)(time - trackers->time[index]);
 }
 
+/* Velocities of the trackers by offset, calculated TRACKER_GROUP at a time
+ * as calculate_velocity() gets to them. */
+#define TRACKER_GROUP 4
+
+struct tracker_kernels;
+
+struct tracker_velocities {
+	const struct tracker_kernels *kernels;
+	unsigned int ready;	/* offsets below this are in v */
+	double v[NUM_POINTER_TRACKERS + TRACKER_GROUP];
+};
+
+static double
+tracker_velocity(struct pointer_accelerator *accel,
+		 struct tracker_velocities *velocities,
+		 unsigned int offset, unsigned int index, uint32_t time);
+
+/*
+ * velocities, if not NULL, calculates the velocities for the batch path,
+ * else they are calculated one by one.
+ */
 static double
-calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
+calculate_velocity(struct pointer_accelerator *accel, uint32_t time,
+		   struct tracker_velocities *velocities)
 {
-	struct pointer_tracker *tracker;
+	struct pointer_trackers *trackers = accel->trackers;
+	unsigned int index;
 	double velocity;
 	double result = 0.0;
 	double initial_velocity;
 	double velocity_diff;
 	unsigned int offset;
 
-	unsigned int dir = tracker_by_offset(accel, 0)->dir;
+	unsigned int dir = trackers->dir[tracker_by_offset(accel, 0)];
 
 	/* Find first velocity */
 	for (offset = 1; offset < NUM_POINTER_TRACKERS; offset++) {
-		tracker = tracker_by_offset(accel, offset);
+		index = tracker_by_offset(accel, offset);
 
-		if (time <= tracker->time)
+		if (time <= trackers->time[index])
 			continue;
 
 		result = initial_velocity =
-			calculate_tracker_velocity(tracker, time);
+			tracker_velocity(accel, velocities, offset, index, time);
 		if (initial_velocity > 0.0)
 			break;
 	}
@@ -198,19 +276,19 @@ calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
 	/* Find least recent vector within a timelimit, maximum velocity diff
 	 * and direction threshold. */
 	for (; offset < NUM_POINTER_TRACKERS; offset++) {
-		tracker = tracker_by_offset(accel, offset);
+		index = tracker_by_offset(accel, offset);
 
 		/* Stop if too far away in time */
-		if (time - tracker->time > MOTION_TIMEOUT ||
-		    tracker->time > time)
+		if (time - trackers->time[index] > MOTION_TIMEOUT ||
+		    trackers->time[index] > time)
 			break;
 
 		/* Stop if direction changed */
-		dir &= tracker->dir;
+		dir &= trackers->dir[index];
 		if (dir == 0)
 			break;
 
-		velocity = calculate_tracker_velocity(tracker, time);
+		velocity = tracker_velocity(accel, velocities, offset, index, time);
 
 		/* Stop if velocity differs too much from initial */
 		velocity_diff = fabs(initial_velocity - velocity);
@@ -272,17 +350,12 @@ apply_softening(struct pointer_accelerator *accel,
 }
 
 static void
-accelerator_filter(struct weston_motion_filter *filter,
-		   struct weston_motion_params *motion,
-		   void *data, uint32_t time)
+accelerate(struct pointer_accelerator *accel,
+	   struct weston_motion_params *motion,
+	   double velocity, void *data, uint32_t time)
 {
-	struct pointer_accelerator *accel =
-		(struct pointer_accelerator *) filter;
-	double velocity;
 	double accel_value;
 
-	feed_trackers(accel, motion->dx, motion->dy, time);
-	velocity = calculate_velocity(accel, time);
 	accel_value = calculate_acceleration(accel, data, velocity, time);
 
 	motion->dx = accel_value * motion->dx;
@@ -296,6 +369,245 @@ accelerator_filter(struct weston_motion_filter *filter,
 	accel->last_velocity = velocity;
 }
 
+static void
+accelerator_filter(struct weston_motion_filter *filter,
+		   struct weston_motion_params *motion,
+		   void *data, uint32_t time)
+{
+	struct pointer_accelerator *accel =
+		(struct pointer_accelerator *) filter;
+	double velocity;
+
+	feed_trackers(accel, motion->dx, motion->dy, time);
+	velocity = calculate_velocity(accel, time, NULL);
+	accelerate(accel, motion, velocity, data, time);
+}
+
+/*
+ * Batch path. The trackers are fed and their velocities calculated with
+ * vector instructions, the rest is the scalar code above. The velocities
+ * go a group of the most recent trackers at a time, as calculate_velocity()
+ * mostly stops after the first few. Every operation is the same IEEE one
+ * on the same operands as in the scalar path, so the results are bit for
+ * bit the same: the integer truncation of calculate_tracker_velocity()
+ * becomes a truncating conversion, and its integer dx*dx + dy*dy is exact
+ * in doubles as long as it does not overflow an int, which is checked,
+ * falling back to scalar.
+ */
+
+/* |dx| and |dy| below this keep dx*dx + dy*dy within an int */
+#define TRACKER_VECTOR_LIMIT 32768.0
+
+struct tracker_kernels {
+	void (*feed)(struct pointer_trackers *trackers, double dx, double dy);
+	/* TRACKER_GROUP velocities, returns 0 if they were not calculated */
+	int (*velocities)(const double *dx, const double *dy, const double *dt,
+			  double *v);
+};
+
+static int
+velocities_scalar(const double *dx, const double *dy, const double *dt,
+		  double *v)
+{
+	int i, x, y;
+
+	for (i = 0; i < TRACKER_GROUP; i++) {
+		if (fabs(dx[i]) >= TRACKER_VECTOR_LIMIT ||
+		    fabs(dy[i]) >= TRACKER_VECTOR_LIMIT)
+			return 0;
+
+		x = dx[i];
+		y = dy[i];
+		v[i] = sqrt(x*x + y*y) / dt[i];
+	}
+
+	return 1;
+}
+
+static const struct tracker_kernels tracker_kernels_scalar = {
+	accumulate_trackers,
+	velocities_scalar
+};
+
+static double
+tracker_velocity(struct pointer_accelerator *accel,
+		 struct tracker_velocities *velocities,
+		 unsigned int offset, unsigned int index, uint32_t time)
+{
+	struct pointer_trackers *trackers = accel->trackers;
+	double dx[TRACKER_GROUP], dy[TRACKER_GROUP], dt[TRACKER_GROUP];
+	double *v;
+	unsigned int i, first;
+
+	if (velocities == NULL)
+		return calculate_tracker_velocity(trackers, index, time);
+
+	while (offset >= velocities->ready) {
+		first = velocities->ready;
+		v = &velocities->v[first];
+
+		for (i = 0; i < TRACKER_GROUP; i++) {
+			index = tracker_by_offset(accel,
+				(first + i) % NUM_POINTER_TRACKERS);
+			dx[i] = trackers->dx[index];
+			dy[i] = trackers->dy[index];
+			dt[i] = (double)(time - trackers->time[index]);
+		}
+
+		if (!velocities->kernels->velocities(dx, dy, dt, v))
+			for (i = 0; i < TRACKER_GROUP; i++)
+				v[i] = calculate_tracker_velocity(trackers,
+					tracker_by_offset(accel,
+						(first + i) % NUM_POINTER_TRACKERS),
+					time);
+
+		velocities->ready += TRACKER_GROUP;
+	}
+
+	return velocities->v[offset];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2"))) static void
+feed_sse2(struct pointer_trackers *trackers, double dx, double dy)
+{
+	__m128d vdx = _mm_set1_pd(dx), vdy = _mm_set1_pd(dy);
+	int i;
+
+	for (i = 0; i < NUM_POINTER_TRACKERS; i += 2) {
+		_mm_storeu_pd(&trackers->dx[i],
+			      _mm_add_pd(_mm_loadu_pd(&trackers->dx[i]), vdx));
+		_mm_storeu_pd(&trackers->dy[i],
+			      _mm_add_pd(_mm_loadu_pd(&trackers->dy[i]), vdy));
+	}
+}
+
+__attribute__((target("sse2"))) static int
+velocities_sse2(const double *dx, const double *dy, const double *dt,
+		double *v)
+{
+	const __m128d limit = _mm_set1_pd(TRACKER_VECTOR_LIMIT);
+	const __m128d sign = _mm_set1_pd(-0.0);
+	__m128d x, y, big = _mm_setzero_pd();
+	int i;
+
+	for (i = 0; i < TRACKER_GROUP; i += 2) {
+		/* truncate like the int conversion */
+		x = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_loadu_pd(&dx[i])));
+		y = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_loadu_pd(&dy[i])));
+		big = _mm_or_pd(big, _mm_cmpge_pd(_mm_andnot_pd(sign, x), limit));
+		big = _mm_or_pd(big, _mm_cmpge_pd(_mm_andnot_pd(sign, y), limit));
+
+		x = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)));
+		_mm_storeu_pd(&v[i], _mm_div_pd(x, _mm_loadu_pd(&dt[i])));
+	}
+
+	return _mm_movemask_pd(big) == 0;
+}
+
+static const struct tracker_kernels tracker_kernels_sse2 = {
+	feed_sse2,
+	velocities_sse2
+};
+
+__attribute__((target("avx2"))) static void
+feed_avx2(struct pointer_trackers *trackers, double dx, double dy)
+{
+	__m256d vdx = _mm256_set1_pd(dx), vdy = _mm256_set1_pd(dy);
+	int i;
+
+	for (i = 0; i < NUM_POINTER_TRACKERS; i += 4) {
+		_mm256_storeu_pd(&trackers->dx[i],
+				 _mm256_add_pd(_mm256_loadu_pd(&trackers->dx[i]),
+					       vdx));
+		_mm256_storeu_pd(&trackers->dy[i],
+				 _mm256_add_pd(_mm256_loadu_pd(&trackers->dy[i]),
+					       vdy));
+	}
+}
+
+__attribute__((target("avx2"))) static int
+velocities_avx2(const double *dx, const double *dy, const double *dt,
+		double *v)
+{
+	const __m256d limit = _mm256_set1_pd(TRACKER_VECTOR_LIMIT);
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	__m256d x, y, big;
+
+	x = _mm256_round_pd(_mm256_loadu_pd(dx),
+			    _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+	y = _mm256_round_pd(_mm256_loadu_pd(dy),
+			    _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+	big = _mm256_or_pd(
+		_mm256_cmp_pd(_mm256_andnot_pd(sign, x), limit, _CMP_NLT_UQ),
+		_mm256_cmp_pd(_mm256_andnot_pd(sign, y), limit, _CMP_NLT_UQ));
+
+	x = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x, x),
+					 _mm256_mul_pd(y, y)));
+	_mm256_storeu_pd(v, _mm256_div_pd(x, _mm256_loadu_pd(dt)));
+
+	return _mm256_movemask_pd(big) == 0;
+}
+
+static const struct tracker_kernels tracker_kernels_avx2 = {
+	feed_avx2,
+	velocities_avx2
+};
+
+/* SSE2 is part of x86_64, only i386 has to ask */
+#ifdef __SSE2__
+#define tracker_has_sse2() 1
+#else
+#define tracker_has_sse2() __builtin_cpu_supports("sse2")
+#endif
+
+static const struct tracker_kernels *
+tracker_kernels(void)
+{
+	if (__builtin_cpu_supports("avx2"))
+		return &tracker_kernels_avx2;
+	if (tracker_has_sse2())
+		return &tracker_kernels_sse2;
+
+	return &tracker_kernels_scalar;
+}
+
+#else
+
+static const struct tracker_kernels *
+tracker_kernels(void)
+{
+	return &tracker_kernels_scalar;
+}
+
+#endif
+
+static void
+accelerator_filter_batch(struct weston_motion_filter *filter,
+			 struct weston_motion_params *motion,
+			 const uint32_t *time, int count, void *data)
+{
+	struct pointer_accelerator *accel =
+		(struct pointer_accelerator *) filter;
+	struct tracker_velocities velocities;
+	double velocity;
+	int i;
+
+	velocities.kernels = tracker_kernels();
+
+	for (i = 0; i < count; i++) {
+		velocities.kernels->feed(accel->trackers,
+					 motion[i].dx, motion[i].dy);
+		advance_tracker(accel, motion[i].dx, motion[i].dy, time[i]);
+
+		velocities.ready = 1;
+		velocity = calculate_velocity(accel, time[i], &velocities);
+
+		accelerate(accel, &motion[i], velocity, data, time[i]);
+	}
+}
+
 static void
 accelerator_destroy(struct weston_motion_filter *filter)
 {
@@ -308,11 +620,13 @@ accelerator_destroy(struct weston_motion_filter *filter)
 
 struct weston_motion_filter_interface accelerator_interface = {
 	accelerator_filter,
-	accelerator_destroy
+	accelerator_destroy,
+	accelerator_filter_batch
 };
 
-struct weston_motion_filter *
-create_pointer_accelator_filter(accel_profile_func_t profile)
+static struct weston_motion_filter *
+create_accelerator(accel_profile_func_t profile,
+		   const struct weston_accel_profile *params)
 {
 	struct pointer_accelerator *filter;
 
@@ -324,13 +638,407 @@ create_pointer_accelator_filter(accel_profile_func_t profile)
 	wl_list_init(&filter->base.link);
 
 	filter->profile = profile;
+	filter->params = params;
 	filter->last_velocity = 0.0;
 	filter->last_dx = 0;
 	filter->last_dy = 0;
 
-	filter->trackers =
-		calloc(NUM_POINTER_TRACKERS, sizeof *filter->trackers);
+	filter->trackers = calloc(1, sizeof *filter->trackers);
+	if (filter->trackers == NULL) {
+		free(filter);
+		return NULL;
+	}
 	filter->cur_tracker = 0;
 
 	return &filter->base;
 }
+
+struct weston_motion_filter *
+create_pointer_accelator_filter(accel_profile_func_t profile)
+{
+	return create_accelerator(profile, NULL);
+}
+
+/*
+ * Linear filter, the motion times a constant
+ */
+
+struct linear_accelerator {
+	struct weston_motion_filter base;
+	double speed;
+};
+
+static void
+linear_filter(struct weston_motion_filter *filter,
+	      struct weston_motion_params *motion,
+	      void *data, uint32_t time)
+{
+	struct linear_accelerator *accel =
+		(struct linear_accelerator *) filter;
+
+	motion->dx *= accel->speed;
+	motion->dy *= accel->speed;
+}
+
+static void
+linear_destroy(struct weston_motion_filter *filter)
+{
+	free(filter);
+}
+
+struct weston_motion_filter_interface linear_interface = {
+	linear_filter,
+	linear_destroy,
+	NULL
+};
+
+struct weston_motion_filter *
+create_linear_acceleration_filter(double speed)
+{
+	struct linear_accelerator *filter;
+
+	filter = malloc(sizeof *filter);
+	if (filter == NULL)
+		return NULL;
+
+	filter->base.interface = &linear_interface;
+	wl_list_init(&filter->base.link);
+	filter->speed = speed;
+
+	return &filter->base;
+}
+
+/*
+ * Acceleration profiles. A profile is parsed once from its spec and then
+ * only read, so one profile serves any number of devices and threads.
+ * The curves through points are sampled into a lookup table, which is
+ * evaluated in constant time three times per motion.
+ */
+
+#define ACCEL_LUT_SIZE		256
+#define ACCEL_MAX_POINTS	32
+/* linear clamps the factor within these, as the touchpad does */
+#define DEFAULT_LINEAR_MIN_FACTOR 0.16
+#define DEFAULT_LINEAR_MAX_FACTOR 1.0
+
+struct accel_profile_type;
+
+struct weston_accel_profile {
+	const struct accel_profile_type *type;
+	double factor, min, max;	/* flat, linear */
+	double lut_scale;		/* lut entries per unit of velocity */
+	double lut[ACCEL_LUT_SIZE + 1];
+};
+
+struct accel_profile_type {
+	const char *name;
+	int (*parse)(struct weston_accel_profile *profile, const char *args);
+	struct weston_motion_filter *
+		(*create)(const struct weston_accel_profile *profile,
+			  accel_profile_func_t device_profile);
+};
+
+/* numbers separated by sep, returns how many or -1 */
+static int
+parse_numbers(const char *args, char sep, double *v, int max)
+{
+	char *end;
+	int n = 0;
+
+	while (n < max) {
+		v[n++] = strtod(args, &end);
+		if (end == args)
+			return -1;
+		if (*end == '\0')
+			return n;
+		if (*end != sep)
+			return -1;
+		args = end + 1;
+	}
+
+	return -1;
+}
+
+/* velocity=factor points, by growing velocity; returns how many or -1 */
+static int
+parse_points(const char *args, double *x, double *y)
+{
+	double v[2 * ACCEL_MAX_POINTS];
+	char buf[64];
+	const char *next;
+	size_t len;
+	int n = 0;
+
+	while (args && (n < ACCEL_MAX_POINTS)) {
+		next = strchr(args, ',');
+		len = next ? (size_t)(next - args) : strlen(args);
+		if (len >= sizeof(buf))
+			return -1;
+		memcpy(buf, args, len);
+		buf[len] = '\0';
+
+		if (parse_numbers(buf, '=', &v[2 * n], 2) != 2)
+			return -1;
+		x[n] = v[2 * n];
+		y[n] = v[2 * n + 1];
+		if ((x[n] < 0) || ((n > 0) && (x[n] <= x[n - 1])))
+			return -1;
+		n++;
+
+		args = next ? next + 1 : NULL;
+	}
+
+	return ((args == NULL) && (n >= 2) && (x[n - 1] > 0)) ? n : -1;
+}
+
+static double
+linear_profile(struct weston_motion_filter *filter,
+	       void *data, double velocity, uint32_t time)
+{
+	const struct weston_accel_profile *profile =
+		((struct pointer_accelerator *) filter)->params;
+	double factor;
+
+	factor = velocity * profile->factor;
+
+	if (factor > profile->max)
+		factor = profile->max;
+	else if (factor < profile->min)
+		factor = profile->min;
+
+	return factor;
+}
+
+static double
+lut_profile(struct weston_motion_filter *filter,
+	    void *data, double velocity, uint32_t time)
+{
+	const struct weston_accel_profile *profile =
+		((struct pointer_accelerator *) filter)->params;
+	double x = velocity * profile->lut_scale;
+	int i;
+
+	if (!(x > 0.0))
+		return profile->lut[0];
+	if (x >= ACCEL_LUT_SIZE)
+		return profile->lut[ACCEL_LUT_SIZE];
+
+	i = x;
+	return profile->lut[i] + (x - i) * (profile->lut[i + 1] -
+					    profile->lut[i]);
+}
+
+/* samples the curve through the points, f(x, y, m, n, i, t) on segment i */
+static void
+fill_lut(struct weston_accel_profile *profile,
+	 const double *x, const double *y, const double *m, int n,
+	 double (*f)(const double *x, const double *y, const double *m,
+		     int i, double t))
+{
+	double v;
+	int i = 0, j;
+
+	profile->lut_scale = ACCEL_LUT_SIZE / x[n - 1];
+
+	for (j = 0; j <= ACCEL_LUT_SIZE; j++) {
+		v = j / profile->lut_scale;
+		while ((i < n - 2) && (v >= x[i + 1]))
+			i++;
+
+		if (v <= x[0])
+			profile->lut[j] = y[0];
+		else if (j == ACCEL_LUT_SIZE)
+			profile->lut[j] = y[n - 1];
+		else
+			profile->lut[j] = f(x, y, m, i,
+					    (v - x[i]) / (x[i + 1] - x[i]));
+	}
+}
+
+static double
+segment_linear(const double *x, const double *y, const double *m,
+	       int i, double t)
+{
+	return y[i] + t * (y[i + 1] - y[i]);
+}
+
+/* cubic Hermite, m are the tangents */
+static double
+segment_hermite(const double *x, const double *y, const double *m,
+		int i, double t)
+{
+	double h = x[i + 1] - x[i];
+	double t2 = t * t, t3 = t2 * t;
+
+	return (2*t3 - 3*t2 + 1) * y[i] + (t3 - 2*t2 + t) * h * m[i] +
+	       (-2*t3 + 3*t2) * y[i + 1] + (t3 - t2) * h * m[i + 1];
+}
+
+static int
+parse_none(struct weston_accel_profile *profile, const char *args)
+{
+	return args ? -1 : 0;
+}
+
+static int
+parse_flat(struct weston_accel_profile *profile, const char *args)
+{
+	if (!args || (parse_numbers(args, ':', &profile->factor, 1) != 1))
+		return -1;
+
+	return 0;
+}
+
+static int
+parse_linear(struct weston_accel_profile *profile, const char *args)
+{
+	double v[3] = {
+		0, DEFAULT_LINEAR_MIN_FACTOR, DEFAULT_LINEAR_MAX_FACTOR
+	};
+	int n = args ? parse_numbers(args, ':', v, 3) : -1;
+
+	if ((n != 1) && (n != 3))
+		return -1;
+	if (v[1] > v[2])
+		return -1;
+
+	profile->factor = v[0];
+	profile->min = v[1];
+	profile->max = v[2];
+
+	return 0;
+}
+
+static int
+parse_table(struct weston_accel_profile *profile, const char *args)
+{
+	double x[ACCEL_MAX_POINTS], y[ACCEL_MAX_POINTS];
+	int n = args ? parse_points(args, x, y) : -1;
+
+	if (n < 0)
+		return -1;
+
+	fill_lut(profile, x, y, NULL, n, segment_linear);
+
+	return 0;
+}
+
+/* monotone cubic (Fritsch-Carlson), it does not overshoot the points */
+static int
+parse_spline(struct weston_accel_profile *profile, const char *args)
+{
+	double x[ACCEL_MAX_POINTS], y[ACCEL_MAX_POINTS];
+	double d[ACCEL_MAX_POINTS], m[ACCEL_MAX_POINTS];
+	double a, b, s;
+	int i, n = args ? parse_points(args, x, y) : -1;
+
+	if (n < 2)
+		return -1;
+
+	for (i = 0; i < n - 1; i++)
+		d[i] = (y[i + 1] - y[i]) / (x[i + 1] - x[i]);
+
+	m[0] = d[0];
+	m[n - 1] = d[n - 2];
+	for (i = 1; i < n - 1; i++)
+		m[i] = (d[i - 1] * d[i] <= 0) ? 0 : (d[i - 1] + d[i]) / 2;
+
+	for (i = 0; i < n - 1; i++) {
+		if (d[i] == 0) {
+			m[i] = m[i + 1] = 0;
+			continue;
+		}
+		a = m[i] / d[i];
+		b = m[i + 1] / d[i];
+		s = a*a + b*b;
+		if (s > 9) {
+			s = 3 / sqrt(s);
+			m[i] = s * a * d[i];
+			m[i + 1] = s * b * d[i];
+		}
+	}
+
+	fill_lut(profile, x, y, m, n, segment_hermite);
+
+	return 0;
+}
+
+static struct weston_motion_filter *
+create_device(const struct weston_accel_profile *profile,
+	      accel_profile_func_t device_profile)
+{
+	return create_pointer_accelator_filter(device_profile);
+}
+
+static struct weston_motion_filter *
+create_flat(const struct weston_accel_profile *profile,
+	    accel_profile_func_t device_profile)
+{
+	return create_linear_acceleration_filter(profile->factor);
+}
+
+static struct weston_motion_filter *
+create_linear(const struct weston_accel_profile *profile,
+	      accel_profile_func_t device_profile)
+{
+	return create_accelerator(linear_profile, profile);
+}
+
+static struct weston_motion_filter *
+create_lut(const struct weston_accel_profile *profile,
+	   accel_profile_func_t device_profile)
+{
+	return create_accelerator(lut_profile, profile);
+}
+
+static const struct accel_profile_type accel_profile_types[] = {
+	{ "touchpad", parse_none, create_device },
+	{ "flat", parse_flat, create_flat },
+	{ "linear", parse_linear, create_linear },
+	{ "table", parse_table, create_lut },
+	{ "spline", parse_spline, create_lut },
+};
+
+struct weston_accel_profile *
+weston_accel_profile_create(const char *spec)
+{
+	struct weston_accel_profile *profile;
+	const char *args = strchr(spec, ':');
+	size_t len = args ? (size_t)(args - spec) : strlen(spec);
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(accel_profile_types); i++)
+		if ((strlen(accel_profile_types[i].name) == len) &&
+		    (0 == strncmp(accel_profile_types[i].name, spec, len)))
+			break;
+	if (i == ARRAY_LENGTH(accel_profile_types))
+		return NULL;
+
+	profile = calloc(1, sizeof *profile);
+	if (profile == NULL)
+		return NULL;
+
+	profile->type = &accel_profile_types[i];
+	if (profile->type->parse(profile, args ? args + 1 : NULL) < 0) {
+		free(profile);
+		return NULL;
+	}
+
+	return profile;
+}
+
+void
+weston_accel_profile_destroy(struct weston_accel_profile *profile)
+{
+	free(profile);
+}
+
+struct weston_motion_filter *
+weston_accel_profile_filter(const struct weston_accel_profile *profile,
+			    accel_profile_func_t device_profile)
+{
+	if (profile == NULL)
+		return create_pointer_accelator_filter(device_profile);
+
+	return profile->type->create(profile, device_profile);
+}
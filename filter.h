@@ -38,12 +38,22 @@ weston_filter_dispatch(struct weston_motion_filter *filter,
 		       struct weston_motion_params *motion,
 		       void *data, uint32_t time);
 
+/* Filters count motions in place, motion i happened at time[i]. */
+WL_EXPORT void
+weston_filter_dispatch_batch(struct weston_motion_filter *filter,
+			     struct weston_motion_params *motion,
+			     const uint32_t *time, int count, void *data);
+
 
 struct weston_motion_filter_interface {
 	void (*filter)(struct weston_motion_filter *filter,
 		       struct weston_motion_params *motion,
 		       void *data, uint32_t time);
 	void (*destroy)(struct weston_motion_filter *filter);
+	/* optional, weston_filter_dispatch_batch() falls back to filter */
+	void (*filter_batch)(struct weston_motion_filter *filter,
+			     struct weston_motion_params *motion,
+			     const uint32_t *time, int count, void *data);
 };
 
 struct weston_motion_filter {
@@ -62,4 +72,30 @@ typedef double (*accel_profile_func_t)(struct weston_motion_filter *filter,
 WL_EXPORT struct weston_motion_filter *
 create_pointer_accelator_filter(accel_profile_func_t filter);
 
+/*
+ * Acceleration profiles, from a spec "name[:args]":
+ *
+ *   touchpad              the profile of the device
+ *   flat:F                the motion times F, no acceleration
+ *   linear:S[:MIN:MAX]    velocity times S, kept within MIN and MAX
+ *                         (default 0.16 and 1.0)
+ *   table:V=F,V=F,...     piecewise linear through the points,
+ *                         velocity V (units/ms) to factor F
+ *   spline:V=F,V=F,...    monotone cubic through the points
+ *
+ * table and spline are sampled into a lookup table at creation.
+ */
+struct weston_accel_profile;
+
+WL_EXPORT struct weston_accel_profile *
+weston_accel_profile_create(const char *spec);
+
+WL_EXPORT void
+weston_accel_profile_destroy(struct weston_accel_profile *profile);
+
+/* profile may be NULL for the device's own */
+WL_EXPORT struct weston_motion_filter *
+weston_accel_profile_filter(const struct weston_accel_profile *profile,
+			    accel_profile_func_t device_profile);
+
 #endif // _FILTER_H_